@@ -0,0 +1,548 @@
+/*-
+ * Copyright (c) Keith Gaughan, 2007.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Benchmarks for the library, built with `make bench'. Not part of the
+ * library itself: this file's empty unless BENCH_MAIN is defined.
+ */
+
+#ifdef BENCH_MAIN
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cards.h"
+
+#define BENCH_NUMBERS 20000000
+
+/* Room for the digits of the longest number. */
+#define CARD_SCRUBBED_SIZE 32
+
+static double
+now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char* name, size_t n, double elapsed) {
+	printf("%-32s %10.1f M/s (%zu in %.3fs)\n", name, n / elapsed / 1e6, n, elapsed);
+}
+
+static void
+bench_generate(char* buf, size_t cb_buf, unsigned n_threads) {
+	char name[64];
+	double start;
+	size_t n;
+
+	start = now();
+	if (n_threads == 1) {
+		card_numbers_fill(buf, cb_buf, BENCH_NUMBERS, CARDPAT_ALL, 1, &n);
+	} else {
+		card_numbers_fill_parallel(buf, cb_buf, BENCH_NUMBERS, CARDPAT_ALL, 1, n_threads, &n);
+	}
+	snprintf(name, sizeof(name), "generate, %u thread%s", n_threads, n_threads == 1 ? "" : "s");
+	report(name, n, now() - start);
+}
+
+static void
+bench_validate(char* buf, size_t cb_used) {
+	unsigned long found;
+	double start;
+	size_t n;
+	char* line;
+	char* eol;
+
+	/* Split into strings up front, so only validation's timed. */
+	for (line = buf; line < buf + cb_used; line = eol + 1) {
+		eol = memchr(line, '\n', buf + cb_used - line);
+		*eol = '\0';
+	}
+
+	n = 0;
+	found = 0;
+	start = now();
+	for (line = buf; line < buf + cb_used; line += strlen(line) + 1) {
+		found |= card_number_is_well_formed(line, CARDPAT_ALL);
+		n++;
+	}
+	report("card_number_is_well_formed", n, now() - start);
+	if (found == 0) {
+		printf("(nothing validated!)\n");
+	}
+}
+
+struct Checks {
+	const char* buf;
+	size_t cb_used;
+	size_t n;
+};
+
+static void*
+run_checks(void* arg) {
+	struct Checks* checks = arg;
+	const char* line;
+
+	checks->n = 0;
+	for (line = checks->buf; line < checks->buf + checks->cb_used; line += strlen(line) + 1) {
+		card_number_check(line, CARDPAT_ALL, NULL);
+		checks->n++;
+	}
+	return NULL;
+}
+
+/*
+ * The instrumented check on one thread and on several at once, to show the
+ * counting costs little and doesn't get in the way between threads.
+ */
+static void
+bench_check(const char* buf, size_t cb_used, unsigned n_threads) {
+	struct Checks checks[64];
+	pthread_t threads[64];
+	struct CardStats stats;
+	char label[64];
+	double start;
+	size_t n;
+	unsigned i;
+
+	start = now();
+	checks[0].buf = buf;
+	checks[0].cb_used = cb_used;
+	run_checks(&checks[0]);
+	report("card_number_check, 1 thread", checks[0].n, now() - start);
+
+	if (n_threads > ARRAY_SIZE(threads)) {
+		n_threads = ARRAY_SIZE(threads);
+	}
+	if (n_threads > 1) {
+		start = now();
+		for (i = 0; i < n_threads; i++) {
+			checks[i].buf = buf;
+			checks[i].cb_used = cb_used;
+			pthread_create(&threads[i], NULL, run_checks, &checks[i]);
+		}
+		n = 0;
+		for (i = 0; i < n_threads; i++) {
+			pthread_join(threads[i], NULL);
+			n += checks[i].n;
+		}
+		snprintf(label, sizeof(label), "card_number_check, %u threads", n_threads);
+		report(label, n, now() - start);
+	}
+
+	card_stats_get(&stats);
+	printf("%32s", "");
+	for (i = 0; i < CARDCHK_COUNT; i++) {
+		printf(" %llu", stats.reasons[i]);
+	}
+	printf(" (by reason)\n");
+}
+
+/*
+ * Scrubbing by hand and then checking, as callers had to, against doing both
+ * at once, on numbers written out in groups of four as users type them.
+ */
+static void
+bench_scrub(const char* buf, size_t cb_used) {
+	char scrubbed[CARD_SCRUBBED_SIZE];
+	char* raw;
+	char* end;
+	char* p;
+	const char* line;
+	const char* q;
+	unsigned long found;
+	double start;
+	size_t n;
+	size_t i;
+	size_t len;
+
+	raw = malloc(cb_used * 2);
+	if (raw == NULL) {
+		return;
+	}
+	n = 0;
+	p = raw;
+	for (line = buf; line < buf + cb_used; line += strlen(line) + 1) {
+		for (q = line, i = 0; *q != '\0'; q++, i++) {
+			if (i > 0 && i % 4 == 0) {
+				*p++ = ' ';
+			}
+			*p++ = *q;
+		}
+		*p++ = '\0';
+		n++;
+	}
+	end = p;
+
+	found = 0;
+	start = now();
+	for (p = raw; p < end; p += strlen(p) + 1) {
+		for (q = p, i = 0; *q != '\0'; q++) {
+			if (*q != ' ') {
+				scrubbed[i++] = *q;
+			}
+		}
+		scrubbed[i] = '\0';
+		found |= card_number_is_well_formed(scrubbed, CARDPAT_ALL);
+	}
+	report("scrub, then check", n, now() - start);
+
+	start = now();
+	for (p = raw; p < end; p += len + 1) {
+		len = strlen(p);
+		found |= card_number_scrub_and_check(p, len, scrubbed, sizeof(scrubbed), CARDPAT_ALL);
+	}
+	report("card_number_scrub_and_check", n, now() - start);
+
+	if (found == 0) {
+		printf("(nothing validated!)\n");
+	}
+	free(raw);
+}
+
+/*
+ * Writing numbers packed in BCD or held as integers out as text and then
+ * checking them, as callers had to, against checking them as they are.
+ */
+static void
+bench_encoded(const char* buf, size_t cb_used) {
+	struct Encoded {
+		unsigned char bcd[10];
+		unsigned char n_digits;
+		unsigned long long number;
+	}* encoded;
+	char text[CARD_SCRUBBED_SIZE];
+	const char* line;
+	unsigned long found;
+	double start;
+	size_t n;
+	size_t i;
+	unsigned j;
+	unsigned long long rest;
+
+	encoded = calloc(BENCH_NUMBERS, sizeof(*encoded));
+	if (encoded == NULL) {
+		return;
+	}
+	n = 0;
+	for (line = buf; line < buf + cb_used && n < BENCH_NUMBERS; line += strlen(line) + 1) {
+		encoded[n].n_digits = strlen(line);
+		for (j = 0; j < encoded[n].n_digits; j++) {
+			encoded[n].bcd[j / 2] |= (line[j] - '0') << ((j & 1) ? 0 : 4);
+			encoded[n].number = encoded[n].number * 10 + (line[j] - '0');
+		}
+		n++;
+	}
+
+	found = 0;
+	start = now();
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < encoded[i].n_digits; j++) {
+			text[j] = '0' + ((j & 1) ? encoded[i].bcd[j / 2] & 0xF : encoded[i].bcd[j / 2] >> 4);
+		}
+		text[j] = '\0';
+		found |= card_number_is_well_formed(text, CARDPAT_ALL);
+	}
+	report("BCD to text, then check", n, now() - start);
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		found |= card_number_bcd_is_well_formed(encoded[i].bcd, encoded[i].n_digits, CARDPAT_ALL);
+	}
+	report("card_number_bcd_is_well_formed", n, now() - start);
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		rest = encoded[i].number;
+		text[encoded[i].n_digits] = '\0';
+		for (j = encoded[i].n_digits; j > 0; j--) {
+			text[j - 1] = '0' + rest % 10;
+			rest /= 10;
+		}
+		found |= card_number_is_well_formed(text, CARDPAT_ALL);
+	}
+	report("integer to text, then check", n, now() - start);
+
+	start = now();
+	for (i = 0; i < n; i++) {
+		found |= card_number_u64_is_well_formed(encoded[i].number, encoded[i].n_digits, CARDPAT_ALL);
+	}
+	report("card_number_u64_is_well_formed", n, now() - start);
+
+	if (found == 0) {
+		printf("(nothing validated!)\n");
+	}
+	free(encoded);
+}
+
+/* Numbers in the hotlist, and as many again that aren't. */
+#define HOTLIST_NUMBERS 10000000
+
+struct Lookups {
+	const struct CardHotlist* hotlist;
+	const unsigned long long* numbers;
+	size_t n;
+	size_t found;
+};
+
+static void*
+run_lookups(void* arg) {
+	struct Lookups* lookups = arg;
+	size_t i;
+
+	lookups->found = 0;
+	for (i = 0; i < lookups->n; i++) {
+		lookups->found += card_hotlist_contains(lookups->hotlist, lookups->numbers[i]);
+	}
+	return NULL;
+}
+
+static void
+bench_lookups(const char* name, const struct CardHotlist* hotlist, const unsigned long long* numbers, size_t n, unsigned n_threads) {
+	struct Lookups lookups[64];
+	pthread_t threads[64];
+	char label[64];
+	double start;
+	size_t found;
+	unsigned i;
+
+	if (n_threads > ARRAY_SIZE(threads)) {
+		n_threads = ARRAY_SIZE(threads);
+	}
+	start = now();
+	for (i = 0; i < n_threads; i++) {
+		lookups[i].hotlist = hotlist;
+		lookups[i].numbers = numbers;
+		lookups[i].n = n;
+		pthread_create(&threads[i], NULL, run_lookups, &lookups[i]);
+	}
+	found = 0;
+	for (i = 0; i < n_threads; i++) {
+		pthread_join(threads[i], NULL);
+		found += lookups[i].found;
+	}
+	snprintf(label, sizeof(label), "%s, %u thread%s", name, n_threads, n_threads == 1 ? "" : "s");
+	report(label, n * n_threads, now() - start);
+	printf("%32s %10.1f%% found\n", "", 100.0 * found / (n * n_threads));
+}
+
+static void
+bench_hotlist(const char* buf, size_t cb_used, unsigned n_threads) {
+	struct CardHotlist* hotlist;
+	unsigned long long* numbers;
+	const char* line;
+	char path[64];
+	double start;
+	size_t n;
+	int with_filter;
+
+	numbers = malloc(2 * HOTLIST_NUMBERS * sizeof(*numbers));
+	if (numbers == NULL) {
+		return;
+	}
+	n = 0;
+	for (line = buf; line < buf + cb_used && n < 2 * HOTLIST_NUMBERS; line += strlen(line) + 1) {
+		numbers[n++] = strtoull(line, NULL, 10);
+	}
+	snprintf(path, sizeof(path), "/tmp/cards-bench.%ld.hot", (long) getpid());
+
+	for (with_filter = 0; with_filter < 2; with_filter++) {
+		start = now();
+		if (card_hotlist_build(path, numbers, n / 2, with_filter ? 10 : 0) == -1) {
+			perror(path);
+			break;
+		}
+		printf("%-32s %10.3fs%s\n", "card_hotlist_build", now() - start, with_filter ? " (with filter)" : "");
+		start = now();
+		hotlist = card_hotlist_open(path, 0);
+		if (hotlist == NULL) {
+			perror(path);
+			break;
+		}
+		printf("%-32s %10.3fms\n", "card_hotlist_open", (now() - start) * 1000);
+		bench_lookups("hotlist hits", hotlist, numbers, n / 2, 1);
+		bench_lookups("hotlist misses", hotlist, numbers + n / 2, n / 2, 1);
+		if (n_threads > 1) {
+			bench_lookups("hotlist misses", hotlist, numbers + n / 2, n / 2, n_threads);
+		}
+		card_hotlist_close(hotlist);
+	}
+	unlink(path);
+	free(numbers);
+}
+
+/* Distinct BINs in the traffic, and how skewed it is towards the busiest. */
+#define ZIPF_BINS     5000
+#define ZIPF_EXPONENT 1.1
+#define ZIPF_STRIDE   20
+
+static unsigned long long
+next_random(unsigned long long* state) {
+	unsigned long long x;
+
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static void
+time_zipf(const char* name, const char* numbers, size_t n) {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long found;
+	double start;
+	size_t i;
+
+	found = 0;
+	start = now();
+	for (i = 0; i < n; i++) {
+		found |= card_number_is_well_formed(numbers + i * ZIPF_STRIDE, CARDPAT_ALL);
+	}
+	report(name, n, now() - start);
+	card_bin_cache_stats(&hits, &misses);
+	if (hits + misses > 0) {
+		printf("%32s %10.1f%% hits\n", "", 100.0 * hits / (hits + misses));
+	}
+	if (found == 0) {
+		printf("(nothing validated!)\n");
+	}
+}
+
+/*
+ * Numbers from a few thousand BINs, with how often each turns up following
+ * Zipf's law, as real traffic does, checked with the BIN cache and without.
+ */
+static void
+bench_bin_cache(const char* buf, size_t cb_used) {
+	const char* bins[ZIPF_BINS];
+	double cdf[ZIPF_BINS];
+	char* numbers;
+	char* number;
+	const char* line;
+	unsigned long long state;
+	double total;
+	double u;
+	size_t n;
+	size_t len;
+	size_t i;
+	size_t j;
+	size_t lo;
+	size_t hi;
+
+	/* Each BIN's represented by a generated number, distinct in its first six digits. */
+	n = 0;
+	for (line = buf; line < buf + cb_used && n < ZIPF_BINS; line += strlen(line) + 1) {
+		for (i = 0; i < n && strncmp(bins[i], line, 6) != 0; i++) {
+		}
+		if (i == n) {
+			bins[n++] = line;
+		}
+	}
+	total = 0;
+	for (i = 0; i < n; i++) {
+		total += 1.0 / pow(i + 1, ZIPF_EXPONENT);
+		cdf[i] = total;
+	}
+
+	numbers = malloc((size_t) BENCH_NUMBERS * ZIPF_STRIDE);
+	if (numbers == NULL) {
+		return;
+	}
+	state = 88172645463325252ULL;
+	for (i = 0; i < BENCH_NUMBERS; i++) {
+		u = (next_random(&state) >> 11) * (1.0 / 9007199254740992.0) * total;
+		for (lo = 0, hi = n - 1; lo < hi;) {
+			if (cdf[(lo + hi) / 2] < u) {
+				lo = (lo + hi) / 2 + 1;
+			} else {
+				hi = (lo + hi) / 2;
+			}
+		}
+		/* Same BIN and length, new account number, and a check digit to suit. */
+		number = numbers + i * ZIPF_STRIDE;
+		len = strlen(bins[lo]);
+		memcpy(number, bins[lo], len + 1);
+		for (j = 6; j < len - 1; j++) {
+			number[j] = '0' + next_random(&state) % 10;
+		}
+		number[len - 1] = '\0';
+		number[len - 1] = '0' + luhn10_check_digit(number);
+	}
+
+	card_bin_cache_enable(0);
+	time_zipf("Zipfian BINs, no cache", numbers, BENCH_NUMBERS);
+	card_bin_cache_enable(1);
+	time_zipf("Zipfian BINs, BIN cache", numbers, BENCH_NUMBERS);
+	card_bin_cache_enable(0);
+	free(numbers);
+}
+
+int
+main(int argc, char* argv[]) {
+	unsigned n_threads;
+	size_t cb_buf;
+	size_t cb_used;
+	char* buf;
+
+	n_threads = argc > 1 ? (unsigned) atoi(argv[1]) : (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads < 1) {
+		n_threads = 1;
+	}
+
+	/* Enough for the longest numbers, with slack for each thread's share. */
+	cb_buf = (size_t) BENCH_NUMBERS * 20 + n_threads * 64;
+	buf = malloc(cb_buf);
+	if (buf == NULL) {
+		perror("malloc");
+		return 1;
+	}
+
+	/* Fault it all in, so that's not timed. */
+	memset(buf, 0, cb_buf);
+
+	bench_generate(buf, cb_buf, 1);
+	if (n_threads > 1) {
+		bench_generate(buf, cb_buf, n_threads);
+	}
+	cb_used = card_numbers_fill(buf, cb_buf, BENCH_NUMBERS, CARDPAT_ALL, 1, NULL);
+	bench_validate(buf, cb_used);
+	bench_check(buf, cb_used, n_threads);
+	bench_scrub(buf, cb_used);
+	bench_encoded(buf, cb_used);
+	bench_hotlist(buf, cb_used, n_threads);
+	bench_bin_cache(buf, cb_used);
+
+	free(buf);
+	return 0;
+}
+#endif /* BENCH_MAIN */
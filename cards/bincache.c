@@ -0,0 +1,149 @@
+/*-
+ * Copyright (c) Keith Gaughan, 2007.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "cards.h"
+#include "patterns.h"
+
+/*
+ * No prefix is longer than CARD_BIN_DIGITS, so those first few digits of a
+ * number decide which patterns' prefixes it matches; what's left to decide
+ * is whether it's the right length for them, which is cheap. The cache maps
+ * those digits to a mask of the patterns whose prefixes match, so one entry
+ * does for every mask of valid types and every length.
+ *
+ * Each thread has its own cache, set up the first time it's used with the
+ * cache turned on, so there's nothing to lock, and no cache lines shared
+ * between threads. It's direct-mapped, so a lookup is one probe, and an
+ * entry's simply overwritten when another BIN wants its slot.
+ */
+
+#define CACHE_BITS 12
+#define CACHE_SIZE (1 << CACHE_BITS)
+
+struct Entry {
+	/* The BIN plus one, so zero means the entry's empty. */
+	uint32_t key;
+	uint32_t patterns;
+};
+
+struct BinCache {
+	struct Entry entries[CACHE_SIZE];
+	unsigned long long hits;
+	unsigned long long misses;
+};
+
+int card_bin_cache_on;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static __thread struct BinCache* cache;
+
+static void
+make_key(void) {
+	pthread_key_create(&key, free);
+}
+
+static struct BinCache*
+get_cache(void) {
+	if (cache == NULL) {
+		pthread_once(&key_once, make_key);
+		cache = calloc(1, sizeof(*cache));
+		if (cache != NULL) {
+			pthread_setspecific(key, cache);
+		}
+	}
+	return cache;
+}
+
+static uint32_t
+matching_patterns(const char* scrubbed_number) {
+	uint32_t patterns;
+	unsigned i;
+	char* const* pprefix;
+
+	patterns = 0;
+	for (i = 0; i < N_CARD_PATTERNS; i++) {
+		for (pprefix = card_patterns[i]->prefixes; *pprefix != NULL; pprefix++) {
+			if (is_prefixed_by(scrubbed_number, *pprefix)) {
+				patterns |= 1 << i;
+				break;
+			}
+		}
+	}
+	return patterns;
+}
+
+unsigned long
+card_bin_cache_match(const char* scrubbed_number, unsigned len, unsigned long valid_types) {
+	struct BinCache* c;
+	struct Entry* entry;
+	unsigned long candidates;
+	uint32_t bin;
+	unsigned i;
+
+	c = get_cache();
+	if (c == NULL) {
+		return card_patterns_match_uncached(scrubbed_number, len, valid_types);
+	}
+
+	bin = 0;
+	for (i = 0; i < CARD_BIN_DIGITS; i++) {
+		bin = bin * 10 + (scrubbed_number[i] - '0');
+	}
+	/* Fibonacci hashing spreads BINs that share their leading digits. */
+	entry = &c->entries[(uint32_t) ((bin + 1) * 2654435769U) >> (32 - CACHE_BITS)];
+	if (entry->key == bin + 1) {
+		c->hits++;
+	} else {
+		c->misses++;
+		entry->key = bin + 1;
+		entry->patterns = matching_patterns(scrubbed_number);
+	}
+
+	/* The first matching type that allows the length, as with no cache. */
+	for (candidates = entry->patterns & valid_types; candidates != 0; candidates &= candidates - 1) {
+		i = __builtin_ctzl(candidates);
+		if ((card_patterns[i]->lengths & (1 << len)) != 0) {
+			return 1 << i;
+		}
+	}
+	return 0;
+}
+
+void
+card_bin_cache_enable(int enabled) {
+	__atomic_store_n(&card_bin_cache_on, enabled != 0, __ATOMIC_RELAXED);
+}
+
+void
+card_bin_cache_stats(unsigned long long* hits, unsigned long long* misses) {
+	*hits = cache != NULL ? cache->hits : 0;
+	*misses = cache != NULL ? cache->misses : 0;
+}
@@ -26,13 +26,7 @@
  */
 
 #include "cards.h"
-
-struct CardPattern {
-	/* Each bit that's set indicates a valid length. */
-	unsigned long lengths;
-	/* List of prefixes. */
-	char* prefixes[];
-};
+#include "patterns.h"
 
 static const struct CardPattern cp_amex = {
 	1 << 15, {
@@ -188,7 +182,7 @@ static const struct CardPattern cp_electron = {
 	}
 };
 
-static const struct CardPattern * const patterns[] = {
+const struct CardPattern * const card_patterns[N_CARD_PATTERNS] = {
 	&cp_amex,     /*  0: American Express */
 	&cp_cup,      /*  1: China Union Pay */
 	&cp_cb,       /*  2: Carte Blanche */
@@ -205,41 +199,56 @@ static const struct CardPattern * const patterns[] = {
 	&cp_visa      /* 13: Visa */
 };
 
-int
-luhn10(const char* scrubbed_number) {
-	/* Lookup table to simplify the logic. */
-	static const int odd[]  = { 0, 2, 4, 6, 8, 1, 3, 5, 7, 9 };
+/* Lookup table to simplify the logic. */
+const int luhn10_doubled[10] = { 0, 2, 4, 6, 8, 1, 3, 5, 7, 9 };
 
+int
+luhn10_sum(const char* number, size_t len, int alt) {
 	int sum;
-	int len;
 	const char* pch;
-	int alt;
-
-	/* The number must be at least two (including the check) digits long. */
-	len = strlen(scrubbed_number);
-	if (len < 2) {
-		return 0;
-	}
 
-	alt = 0;
 	sum = 0;
-	pch = scrubbed_number + len - 1;
-	while (pch >= scrubbed_number) {
+	pch = number + len - 1;
+	while (pch >= number) {
 		if (*pch < '0' || *pch > '9') {
 			/* Somebody's trying to tamper with us! */
-			return 0;
+			return -1;
 		}
-		sum += alt ? odd[*pch - '0'] : *pch - '0';
+		sum += alt ? luhn10_doubled[*pch - '0'] : *pch - '0';
 		if (sum >= 10) {
 			sum -= 10;
 		}
 		alt = !alt;
 		pch--;
 	}
-	return sum == 0;
+	return sum;
 }
 
-static int
+int
+luhn10(const char* scrubbed_number) {
+	size_t len;
+
+	/* The number must be at least two (including the check) digits long. */
+	len = strlen(scrubbed_number);
+	if (len < 2) {
+		return 0;
+	}
+	return luhn10_sum(scrubbed_number, len, 0) == 0;
+}
+
+int
+luhn10_check_digit(const char* partial_number) {
+	int sum;
+
+	/* The check digit will be the rightmost, so the digit before it's doubled. */
+	sum = luhn10_sum(partial_number, strlen(partial_number), 1);
+	if (sum < 0) {
+		return -1;
+	}
+	return sum == 0 ? 0 : 10 - sum;
+}
+
+int
 is_prefixed_by(const char* s, const char* prefix) {
 	while (*prefix != '\0' && *s == *prefix) {
 		s++;
@@ -249,20 +258,14 @@ is_prefixed_by(const char* s, const char* prefix) {
 }
 
 unsigned long
-card_number_is_well_formed(const char* scrubbed_number, unsigned long valid_types) {
+card_patterns_match_uncached(const char* scrubbed_number, unsigned len, unsigned long valid_types) {
 	unsigned i;
-	unsigned len;
 	char* const* pprefix;
 
-	if (!luhn10(scrubbed_number)) {
-		return 0;
-	}
-
-	len = strlen(scrubbed_number);
-	for (i = 0; i < ARRAY_SIZE(patterns); i++) {
+	for (i = 0; i < ARRAY_SIZE(card_patterns); i++) {
 		/* Is in the list of valid types and is the right length. */
-		if ((valid_types & (1 << i)) != 0 && (patterns[i]->lengths & (1 << len)) != 0) {
-			for (pprefix = patterns[i]->prefixes; *pprefix != NULL; pprefix++) {
+		if ((valid_types & (1 << i)) != 0 && (card_patterns[i]->lengths & (1 << len)) != 0) {
+			for (pprefix = card_patterns[i]->prefixes; *pprefix != NULL; pprefix++) {
 				if (is_prefixed_by(scrubbed_number, *pprefix)) {
 					return 1 << i;
 				}
@@ -272,8 +275,26 @@ card_number_is_well_formed(const char* scrubbed_number, unsigned long valid_type
 	return 0;
 }
 
+unsigned long
+card_patterns_match(const char* scrubbed_number, unsigned len, unsigned long valid_types) {
+	if (len >= CARD_BIN_DIGITS && len <= CARD_MAX_LENGTH && __atomic_load_n(&card_bin_cache_on, __ATOMIC_RELAXED)) {
+		return card_bin_cache_match(scrubbed_number, len, valid_types);
+	}
+	return card_patterns_match_uncached(scrubbed_number, len, valid_types);
+}
+
+unsigned long
+card_number_is_well_formed(const char* scrubbed_number, unsigned long valid_types) {
+	if (!luhn10(scrubbed_number)) {
+		return 0;
+	}
+	return card_patterns_match(scrubbed_number, strlen(scrubbed_number), valid_types);
+}
+
 #ifdef TEST_MAIN
+#include <pthread.h>
 #include <stdio.h>
+#include <unistd.h>
 
 static const char* good_checksums[] = {
 	"00"
@@ -295,6 +316,94 @@ static const char* malformed_cards[] = {
 	"40055598765400"
 };
 
+static const char* check_digits[] = {
+	"00",
+	"18",
+	"4005559876540",
+	"378282246310005",
+	"5555555555554444",
+	"6011111111111117"
+};
+
+static const char* good_raw_cards[] = {
+	"4005559876540",
+	" 4005 5598 7654 0 ",
+	"4005-5598-7654-0",
+	"4005.5598.7654.0",
+	"\t4005559876540\r\n",
+	"  3782 822463 10005",
+	"6011-1111-1111-1117 ",
+	"5555 5555 5555 4444    ",
+	"4111 1111 1111 1111"
+};
+
+static const char* bad_raw_cards[] = {
+	"",
+	"   ",
+	"4005 5598 7654 1",
+	"4005 5598 7654 0x",
+	"4005_5598_7654_0",
+	"4005 5598\t7654 0",
+	"4005 5598 7654 0 0 0 0 0 0 0",
+	"40055598765400000000000000000000",
+	"4111 1111 1111 1111 1111 1111 1111 1111 1111"
+};
+
+static const char* encoded_cards[] = {
+	"00",
+	"4005559876540",
+	"4005559876541",
+	"378282246310005",
+	"5555555555554444",
+	"6011111111111117",
+	"6011111111111118",
+	"4844000000000000000",
+	"0000000000000000000",
+	"400555987654",
+	"40055598765400"
+};
+
+static const char* hotlisted_cards[] = {
+	"4005559876540",
+	"378282246310005",
+	"5555555555554444",
+	"1000"
+};
+
+static const char* unlisted_cards[] = {
+	"0",
+	"4005559876541",
+	"4111111111111111",
+	"6011111111111117",
+	"1000000"
+};
+
+/* Each prefixed with the reason card_number_check() should give. */
+static const char* checked_cards[] = {
+	"0:4005559876540",
+	"0:378282246310005",
+	"1:4005x59876540",
+	"1:4005 5598 7654 0",
+	"2:",
+	"2:0",
+	"2:4005559876541",
+	"3:0000000000000000",
+	"3:333333333333337",
+	"4:40055598765408"
+};
+
+/* Masks to generate numbers for, as text, for the sake of run_test(). */
+static const char* generated_types[] = {
+	"1",     /* CARDPAT_AMEX */
+	"2",     /* CARDPAT_CUP */
+	"12",    /* CARDPAT_DINERS */
+	"96",    /* CARDPAT_JCB */
+	"3456",  /* CARDPAT_MAESTRO */
+	"512",   /* CARDPAT_MC */
+	"12288", /* CARDPAT_ELECTRON | CARDPAT_VISA */
+	"12287"  /* CARDPAT_ALL */
+};
+
 #define RUN_TEST(data, test) (run_test(#test, ARRAY_SIZE(data), (data), (test_ ## test)))
 
 static int
@@ -338,6 +447,325 @@ test_malformed(const char* number) {
 	return card_number_is_well_formed(number, CARDPAT_ALL) == 0;
 }
 
+/*
+ * Scrubbing as well as checking must agree with scrubbing by hand and
+ * checking the result.
+ */
+static unsigned long
+scrub_agrees(const char* number) {
+	char scrubbed[CARD_MAX_LENGTH + 1];
+	char expected[64];
+	unsigned long result;
+	size_t n;
+	size_t len;
+
+	n = 0;
+	len = strlen(number);
+	result = card_number_scrub_and_check(number, len, scrubbed, sizeof(scrubbed), CARDPAT_ALL);
+	for (; *number != '\0' && n < sizeof(expected) - 1; number++) {
+		if (*number >= '0' && *number <= '9') {
+			expected[n++] = *number;
+		}
+	}
+	expected[n] = '\0';
+	if (result != 0 && strcmp(scrubbed, expected) != 0) {
+		return 0;
+	}
+	return result;
+}
+
+static int
+test_scrub(const char* number) {
+	return scrub_agrees(number) != 0;
+}
+
+static int
+test_bad_scrub(const char* number) {
+	return scrub_agrees(number) == 0;
+}
+
+/*
+ * Checking a number packed as BCD or held as an integer must agree with
+ * checking it as text.
+ */
+static int
+test_encoded(const char* number) {
+	unsigned char bcd[16];
+	unsigned long long n;
+	unsigned long long extra;
+	unsigned long expected;
+	size_t len;
+	size_t i;
+
+	expected = card_number_is_well_formed(number, CARDPAT_ALL);
+	len = strlen(number);
+
+	memset(bcd, 0xFF, sizeof(bcd));
+	n = 0;
+	for (i = 0; i < len; i++) {
+		if (i & 1) {
+			bcd[i / 2] = (bcd[i / 2] & 0xF0) | (number[i] - '0');
+		} else {
+			bcd[i / 2] = ((number[i] - '0') << 4) | 0xF;
+		}
+		n = n * 10 + (number[i] - '0');
+	}
+	if (card_number_bcd_is_well_formed(bcd, len, CARDPAT_ALL) != expected) {
+		return 0;
+	}
+	if (card_number_u64_is_well_formed(n, len, CARDPAT_ALL) != expected) {
+		return 0;
+	}
+
+	/* A digit that's not a digit spoils it. */
+	if (len > 1) {
+		bcd[0] |= 0xA0;
+		if (card_number_bcd_is_well_formed(bcd, len, CARDPAT_ALL) != 0) {
+			return 0;
+		}
+	}
+
+	/*
+	 * So does the integer having more digits than it's said to. The two put
+	 * in front of it leave the checksum and the prefix as they were, so
+	 * it's only the count that can reject it: 5 doubled and 9 as it is, or
+	 * the other way round if the nearer of them is doubled.
+	 */
+	if (expected != 0 && len + 2 < 20) {
+		extra = len & 1 ? 95 : 59;
+		for (i = 0; i < len; i++) {
+			extra *= 10;
+		}
+		if (card_number_u64_is_well_formed(n + extra, len, CARDPAT_ALL) != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Opens a hotlist of the hotlisted cards and a few thousand others, with a
+ * filter or without. It's unlinked straight away, as it stays mapped.
+ */
+static struct CardHotlist*
+get_hotlist(int with_filter) {
+	static struct CardHotlist* hotlists[2];
+	unsigned long long numbers[4096];
+	char path[64];
+	size_t n;
+	size_t i;
+
+	if (hotlists[with_filter] == NULL) {
+		n = 0;
+		for (i = 0; i < ARRAY_SIZE(hotlisted_cards); i++) {
+			numbers[n++] = strtoull(hotlisted_cards[i], NULL, 10);
+			numbers[n++] = strtoull(hotlisted_cards[i], NULL, 10);
+		}
+		for (i = 0; n < ARRAY_SIZE(numbers); i++) {
+			numbers[n++] = 4000000000000000ULL + i * 7919;
+		}
+		snprintf(path, sizeof(path), "/tmp/cards-test.%ld.hot", (long) getpid());
+		if (card_hotlist_build(path, numbers, n, with_filter ? 10 : 0) == 0) {
+			hotlists[with_filter] = card_hotlist_open(path, 0);
+			unlink(path);
+		}
+	}
+	return hotlists[with_filter];
+}
+
+static int
+in_hotlists(const char* number) {
+	unsigned long long n;
+	int i;
+
+	n = strtoull(number, NULL, 10);
+	for (i = 0; i < 2; i++) {
+		if (get_hotlist(i) == NULL || card_hotlist_contains(get_hotlist(i), n) != card_hotlist_contains(get_hotlist(0), n)) {
+			return -1;
+		}
+	}
+	/* Duplicates are only counted once. */
+	if (card_hotlist_size(get_hotlist(1)) != 4096 - ARRAY_SIZE(hotlisted_cards)) {
+		return -1;
+	}
+	return card_hotlist_contains(get_hotlist(0), n);
+}
+
+static int
+test_hotlisted(const char* number) {
+	return in_hotlists(number) == 1;
+}
+
+static int
+test_unlisted(const char* number) {
+	return in_hotlists(number) == 0;
+}
+
+static int
+test_check(const char* expected) {
+	unsigned long type;
+	int reason;
+
+	type = card_number_check(expected + 2, CARDPAT_ALL, &reason);
+	return reason == expected[0] - '0' &&
+		type == card_number_is_well_formed(expected + 2, CARDPAT_ALL);
+}
+
+#define CHECKS_PER_THREAD 1000
+
+static void*
+run_checks(void* arg) {
+	int i;
+
+	for (i = 0; i < CHECKS_PER_THREAD; i++) {
+		card_number_check(arg, CARDPAT_ALL, NULL);
+	}
+	return NULL;
+}
+
+/*
+ * What's counted on threads that have been and gone must be in the totals,
+ * under the right type and reason.
+ */
+static int
+test_stats(const char* expected) {
+	struct CardStats before;
+	struct CardStats after;
+	pthread_t threads[4];
+	unsigned long type;
+	unsigned long long n;
+	int i;
+
+	card_stats_get(&before);
+	for (i = 0; i < (int) ARRAY_SIZE(threads); i++) {
+		if (pthread_create(&threads[i], NULL, run_checks, (void*) (expected + 2)) != 0) {
+			return 0;
+		}
+	}
+	for (i = 0; i < (int) ARRAY_SIZE(threads); i++) {
+		pthread_join(threads[i], NULL);
+	}
+	card_stats_get(&after);
+
+	n = ARRAY_SIZE(threads) * CHECKS_PER_THREAD;
+	type = card_number_is_well_formed(expected + 2, CARDPAT_ALL);
+	for (i = 0; i < CARDCHK_COUNT; i++) {
+		if (after.reasons[i] - before.reasons[i] != (i == expected[0] - '0' ? n : 0)) {
+			return 0;
+		}
+	}
+	for (i = 0; i < CARDPAT_COUNT; i++) {
+		if (after.types[i] - before.types[i] != (type == (1UL << i) ? n : 0)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * The BIN cache must make no difference to the results, whatever types are
+ * asked for, and it only works if no prefix is longer than a BIN.
+ */
+static int
+test_bin_cache(const char* mask) {
+	static char buf[64 * 1024];
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long valid_types;
+	unsigned long cached;
+	size_t cb_used;
+	char* line;
+	char* eol;
+	char* const* pprefix;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(card_patterns); i++) {
+		for (pprefix = card_patterns[i]->prefixes; *pprefix != NULL; pprefix++) {
+			if (strlen(*pprefix) > CARD_BIN_DIGITS) {
+				return 0;
+			}
+		}
+	}
+
+	valid_types = strtoul(mask, NULL, 10);
+	cb_used = card_numbers_fill(buf, sizeof(buf), 1000, valid_types, 7, NULL);
+	for (line = buf; line < buf + cb_used; line = eol + 1) {
+		eol = memchr(line, '\n', buf + cb_used - line);
+		*eol = '\0';
+		/* Spoil some, so the cache has failures to agree on too. */
+		if (eol - line > 4 && line[4] == '0') {
+			line[1] = '9';
+		}
+		for (i = 0; i <= CARDPAT_COUNT; i++) {
+			valid_types = i == CARDPAT_COUNT ? CARDPAT_ALL : 1UL << i;
+			card_bin_cache_enable(1);
+			cached = card_patterns_match(line, eol - line, valid_types);
+			card_bin_cache_enable(0);
+			if (cached != card_patterns_match(line, eol - line, valid_types)) {
+				return 0;
+			}
+		}
+	}
+	card_bin_cache_stats(&hits, &misses);
+	return hits > 0 && misses > 0;
+}
+
+static int
+test_check_digit(const char* number) {
+	char partial[32];
+	size_t len;
+
+	len = strlen(number) - 1;
+	memcpy(partial, number, len);
+	partial[len] = '\0';
+	return luhn10_check_digit(partial) == number[len] - '0';
+}
+
+/*
+ * Counts the lines in a buffer that are well-formed numbers of the given
+ * types, or returns -1 if there's one that isn't.
+ */
+static long
+count_well_formed(char* buf, size_t cb_buf, unsigned long valid_types) {
+	char* line;
+	char* eol;
+	long n;
+
+	n = 0;
+	for (line = buf; line < buf + cb_buf; line = eol + 1) {
+		eol = memchr(line, '\n', buf + cb_buf - line);
+		if (eol == NULL) {
+			return -1;
+		}
+		*eol = '\0';
+		if ((card_number_is_well_formed(line, valid_types) & valid_types) == 0) {
+			return -1;
+		}
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Every number generated must be well-formed for the types asked for,
+ * however many threads it's done on.
+ */
+static int
+test_generate(const char* mask) {
+	static char buf[64 * 1024];
+	unsigned long valid_types;
+	size_t cb_used;
+	size_t n;
+
+	valid_types = strtoul(mask, NULL, 10);
+	cb_used = card_numbers_fill(buf, sizeof(buf), 1000, valid_types, 42, &n);
+	if (n != 1000 || count_well_formed(buf, cb_used, valid_types) != 1000) {
+		return 0;
+	}
+	cb_used = card_numbers_fill_parallel(buf, sizeof(buf), 1000, valid_types, 42, 4, &n);
+	return n == 1000 && count_well_formed(buf, cb_used, valid_types) == 1000;
+}
+
 int
 main(void) {
 	int failed;
@@ -346,6 +774,16 @@ main(void) {
 	failed += RUN_TEST(good_cards, well_formed);
 	failed += RUN_TEST(bad_checksums, bad_luhn10);
 	failed += RUN_TEST(malformed_cards, malformed);
+	failed += RUN_TEST(check_digits, check_digit);
+	failed += RUN_TEST(good_raw_cards, scrub);
+	failed += RUN_TEST(bad_raw_cards, bad_scrub);
+	failed += RUN_TEST(encoded_cards, encoded);
+	failed += RUN_TEST(hotlisted_cards, hotlisted);
+	failed += RUN_TEST(unlisted_cards, unlisted);
+	failed += RUN_TEST(checked_cards, check);
+	failed += RUN_TEST(checked_cards, stats);
+	failed += RUN_TEST(generated_types, generate);
+	failed += RUN_TEST(generated_types, bin_cache);
 	if (failed > 0) {
 		printf("FAILURE: %d failed.\n", failed);
 		return 1;
@@ -73,6 +73,34 @@
 #define CARDPAT_VISA            (1 << 13)
 /* All */
 #define CARDPAT_ALL             (CARDPAT_AMEX | CARDPAT_DINERS | CARDPAT_DISC | CARDPAT_JCB | CARDPAT_MAESTRO | CARDPAT_MC | CARDPAT_VISA)
+/* Number of bits in the masks above */
+#define CARDPAT_COUNT           14
+
+/*
+ * Why card_number_check() did or didn't accept a number.
+ */
+
+/* Well-formed */
+#define CARDCHK_OK              0
+/* Contains something other than digits */
+#define CARDCHK_NOT_DIGITS      1
+/* Fails the Luhn-10 checksum, or is too short to have one */
+#define CARDCHK_BAD_CHECKSUM    2
+/* Doesn't start like any of the card types asked for */
+#define CARDCHK_UNKNOWN_PREFIX  3
+/* Starts like one of the card types asked for, but is the wrong length */
+#define CARDCHK_WRONG_LENGTH    4
+/* Number of reasons */
+#define CARDCHK_COUNT           5
+
+/*
+ * Counts of what card_number_check() has seen, by card type (as the index of
+ * its bit in the CARDPAT_* masks) and by reason.
+ */
+struct CardStats {
+	unsigned long long types[CARDPAT_COUNT];
+	unsigned long long reasons[CARDCHK_COUNT];
+};
 
 BEGIN_C_DECLS
 
@@ -85,6 +113,16 @@ BEGIN_C_DECLS
  */
 extern int luhn10(const char* scrubbed_number);
 
+/**
+ * Works out the Luhn-10 check digit to append to a number.
+ *
+ * @param  partial_number  Number without its check digit (and contains only digits).
+ *
+ * @return The check digit, from 0 to 9, or -1 if the number contains anything
+ *         other than digits.
+ */
+extern int luhn10_check_digit(const char* partial_number);
+
 /**
  * Checks a scrubbed number is in the list of valid cards and is well-formed
  * (including if it passes a Luhn-10 checksum).
@@ -96,6 +134,198 @@ extern int luhn10(const char* scrubbed_number);
  */
 extern unsigned long card_number_is_well_formed(const char* scrubbed_number, unsigned long valid_types);
 
+/**
+ * Does what card_number_is_well_formed() does, but says why a number isn't
+ * well-formed, and counts what it sees, by type and by reason. Each thread
+ * counts separately, so the counting costs next to nothing, and
+ * card_stats_get() adds them up when asked.
+ *
+ * @param  scrubbed_number  Number to check.
+ * @param  valid_types      Bitmask of card types to accept as valid.
+ * @param  reason           Where to put one of the CARDCHK_* codes, if not NULL.
+ *
+ * @return 0 if unvalidated, otherwise the bit representing the card will be set.
+ */
+extern unsigned long card_number_check(const char* scrubbed_number, unsigned long valid_types, int* reason);
+
+/**
+ * Adds up what every thread's counted with card_number_check() so far,
+ * including threads that have since exited. Counts being made while this is
+ * going on may or may not be included.
+ *
+ * @param  stats  Where to put the totals.
+ */
+extern void card_stats_get(struct CardStats* stats);
+
+/**
+ * Turns the BIN cache on or off for every thread. It's off to begin with.
+ * With it on, each thread remembers which card types the first digits of
+ * the last few thousand numbers it's checked matched, so numbers from the
+ * same issuers don't need the prefix lists searching again. It makes no
+ * difference to the results.
+ *
+ * @param  enabled  Non-zero to turn it on, or 0 to turn it off.
+ */
+extern void card_bin_cache_enable(int enabled);
+
+/**
+ * Gets how many times the calling thread's found what it was looking for in
+ * its BIN cache, and how many times it hasn't.
+ *
+ * @param  hits    Where to put the number of hits.
+ * @param  misses  Where to put the number of misses.
+ */
+extern void card_bin_cache_stats(unsigned long long* hits, unsigned long long* misses);
+
+/**
+ * Scrubs a number as a user entered it and checks it's well-formed, all in
+ * one pass. Whitespace around the number is ignored, as are spaces, dashes
+ * and dots amongst the digits, but anything else makes it malformed.
+ *
+ * @param  raw_number   Number to check, as entered.
+ * @param  len          Length of the number as entered.
+ * @param  scrubbed     Buffer for the digits of the number, NUL-terminated.
+ *                      If the number's malformed, what's in it is undefined.
+ * @param  cb_scrubbed  Size of the buffer; numbers with more digits than will
+ *                      fit are malformed.
+ * @param  valid_types  Bitmask of card types to accept as valid.
+ *
+ * @return 0 if unvalidated, otherwise the bit representing the card will be set.
+ */
+extern unsigned long card_number_scrub_and_check(const char* raw_number, size_t len, char* scrubbed, size_t cb_scrubbed, unsigned long valid_types);
+
+/**
+ * Checks a number in packed BCD is well-formed, as card_number_is_well_formed()
+ * does, without it having to be written out as text first. The digits are
+ * packed two to a byte, the first in the high nibble, as ISO 8583 does with
+ * the PAN; with an odd number of digits, the low nibble of the last byte is
+ * padding, and is ignored.
+ *
+ * @param  bcd          Packed digits.
+ * @param  n_digits     Number of digits.
+ * @param  valid_types  Bitmask of card types to accept as valid.
+ *
+ * @return 0 if unvalidated, otherwise the bit representing the card will be set.
+ */
+extern unsigned long card_number_bcd_is_well_formed(const unsigned char* bcd, unsigned n_digits, unsigned long valid_types);
+
+/**
+ * Checks a number held as an integer is well-formed, as
+ * card_number_is_well_formed() does, without it having to be written out as
+ * text first. As leading zeros are lost, the number of digits has to be
+ * given, and a number with more digits than that is malformed.
+ *
+ * @param  number       Number to check.
+ * @param  n_digits     Number of digits, including any leading zeros.
+ * @param  valid_types  Bitmask of card types to accept as valid.
+ *
+ * @return 0 if unvalidated, otherwise the bit representing the card will be set.
+ */
+extern unsigned long card_number_u64_is_well_formed(unsigned long long number, unsigned n_digits, unsigned long valid_types);
+
+/*
+ * A hotlist is a set of card numbers, such as blocked cards, kept in a file
+ * that's mapped into memory rather than read in, so it's ready to use as
+ * soon as it's opened, and can be shared by any number of threads. Numbers
+ * are kept as integers, so leading zeros aren't significant.
+ */
+struct CardHotlist;
+
+/* Read the whole hotlist in when it's opened, rather than as it's used. */
+#define CARD_HOTLIST_PRELOAD 1
+
+/**
+ * Builds a hotlist file. It's written under another name and renamed into
+ * place, so anybody with the old one open keeps on using it undisturbed.
+ *
+ * @param  path                Where to write the hotlist.
+ * @param  numbers             Numbers to put in it, in any order, and
+ *                             duplicates are allowed.
+ * @param  n_numbers           How many numbers there are.
+ * @param  bloom_bits_per_key  Size of the Bloom filter that saves looking
+ *                             up most numbers that aren't in the list, in
+ *                             bits per number; 10 is a good size. 0 leaves
+ *                             it out.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int card_hotlist_build(const char* path, const unsigned long long* numbers, size_t n_numbers, unsigned bloom_bits_per_key);
+
+/**
+ * Opens a hotlist file.
+ *
+ * @param  path   Hotlist to open.
+ * @param  flags  0, or CARD_HOTLIST_PRELOAD.
+ *
+ * @return The hotlist, or NULL on failure with errno set.
+ */
+extern struct CardHotlist* card_hotlist_open(const char* path, int flags);
+
+/**
+ * Checks if a number's in a hotlist.
+ *
+ * @param  hotlist  Hotlist to look in.
+ * @param  number   Number to look for.
+ *
+ * @return Non-zero if it's there, or 0 if it's not.
+ */
+extern int card_hotlist_contains(const struct CardHotlist* hotlist, unsigned long long number);
+
+/**
+ * @param  hotlist  Hotlist to count.
+ *
+ * @return The number of numbers in the hotlist.
+ */
+extern size_t card_hotlist_size(const struct CardHotlist* hotlist);
+
+/**
+ * Closes a hotlist.
+ *
+ * @param  hotlist  Hotlist to close; may be NULL.
+ */
+extern void card_hotlist_close(struct CardHotlist* hotlist);
+
+/**
+ * Fills a buffer with random well-formed card numbers, one per line, each
+ * drawn from the prefixes and lengths of one of the given card types. The
+ * same seed always gives the same numbers.
+ *
+ * @param  buf          Buffer to fill; only whole lines are written to it.
+ * @param  cb_buf       Size of the buffer in bytes.
+ * @param  max_numbers  Most numbers to generate.
+ * @param  valid_types  Bitmask of card types to generate.
+ * @param  seed         Seed for the generator.
+ * @param  n_generated  Where to put how many numbers were generated, if not NULL.
+ *
+ * @return The number of bytes written.
+ */
+extern size_t card_numbers_fill(char* buf, size_t cb_buf, size_t max_numbers, unsigned long valid_types, unsigned long long seed, size_t* n_generated);
+
+/**
+ * Like card_numbers_fill(), but splits the buffer between a number of
+ * threads, each with its own seed derived from the one given. The lines are
+ * moved together afterwards, so the buffer holds them contiguously.
+ *
+ * @param  n_threads  Number of threads to use.
+ *
+ * @return The number of bytes written.
+ */
+extern size_t card_numbers_fill_parallel(char* buf, size_t cb_buf, size_t max_numbers, unsigned long valid_types, unsigned long long seed, unsigned n_threads, size_t* n_generated);
+
+/**
+ * Writes random well-formed card numbers to a file descriptor, one per
+ * line, generating them on a number of threads.
+ *
+ * @param  fd           File descriptor to write to.
+ * @param  count        How many numbers to write.
+ * @param  valid_types  Bitmask of card types to generate.
+ * @param  seed         Seed for the generator.
+ * @param  n_threads    Number of threads to use.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int card_numbers_write(int fd, unsigned long long count, unsigned long valid_types, unsigned long long seed, unsigned n_threads);
+
 END_C_DECLS
 
 #endif /* !TALIDEON_CARDS__cards_h */
@@ -0,0 +1,163 @@
+/*-
+ * Copyright (c) Keith Gaughan, 2007.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+
+#include "cards.h"
+#include "patterns.h"
+
+/*
+ * Numbers that come in packed BCD or as integers are checked as they are,
+ * without being written out as text first. The checksum's worked out a
+ * byte or a pair of digits at a time from tables, and the patterns are only
+ * ever matched against the first few digits, which are the only ones
+ * written out.
+ */
+
+/* Enough for the longest prefix. */
+#define N_HEAD 8
+
+/*
+ * Marks a byte with a nibble that's not a digit. It's above the most the
+ * sums of every byte of the longest number can come to, so it can't be lost
+ * in the total.
+ */
+#define BAD_BYTE 0x100
+
+static const unsigned long long powers_of_10[CARD_MAX_LENGTH + 1] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+	10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+	100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL,
+	10000000000000000000ULL
+};
+
+/*
+ * Luhn-10 sum of each packed byte, with its low nibble doubled or its high
+ * one, or BAD_BYTE if either nibble's not a digit. Filled in on first use.
+ */
+static unsigned short byte_sums[2][256];
+static pthread_once_t byte_sums_once = PTHREAD_ONCE_INIT;
+
+static void
+fill_byte_sums(void) {
+	unsigned b;
+	unsigned hi;
+	unsigned lo;
+
+	for (b = 0; b < 256; b++) {
+		hi = b >> 4;
+		lo = b & 0xF;
+		if (hi > 9 || lo > 9) {
+			byte_sums[0][b] = BAD_BYTE;
+			byte_sums[1][b] = BAD_BYTE;
+		} else {
+			byte_sums[0][b] = hi + luhn10_doubled[lo];
+			byte_sums[1][b] = luhn10_doubled[hi] + lo;
+		}
+	}
+}
+
+unsigned long
+card_number_bcd_is_well_formed(const unsigned char* bcd, unsigned n_digits, unsigned long valid_types) {
+	char head[N_HEAD + 1];
+	const unsigned short* sums;
+	unsigned sum;
+	unsigned i;
+	unsigned last;
+
+	if (n_digits < 2 || n_digits > CARD_MAX_LENGTH) {
+		return 0;
+	}
+	pthread_once(&byte_sums_once, fill_byte_sums);
+
+	/*
+	 * The rightmost digit's never doubled, so with an even number of digits,
+	 * it's the high nibble of every byte that's doubled, and otherwise the
+	 * low one, with the last digit on its own in the last high nibble.
+	 */
+	sums = byte_sums[(n_digits & 1) == 0];
+	sum = 0;
+	for (i = 0; i < n_digits / 2; i++) {
+		sum += sums[bcd[i]];
+	}
+	if (n_digits & 1) {
+		last = bcd[i] >> 4;
+		sum += last > 9 ? BAD_BYTE : last;
+	}
+	if (sum >= BAD_BYTE || sum % 10 != 0) {
+		return 0;
+	}
+
+	for (i = 0; i < N_HEAD && i < n_digits; i++) {
+		head[i] = '0' + ((i & 1) ? bcd[i / 2] & 0xF : bcd[i / 2] >> 4);
+	}
+	head[i] = '\0';
+	return card_patterns_match(head, n_digits, valid_types);
+}
+
+unsigned long
+card_number_u64_is_well_formed(unsigned long long number, unsigned n_digits, unsigned long valid_types) {
+	char head[N_HEAD + 1];
+	unsigned long long rest;
+	unsigned quad;
+	unsigned pair;
+	unsigned sum;
+	unsigned i;
+
+	if (n_digits < 2 || n_digits > CARD_MAX_LENGTH) {
+		return 0;
+	}
+	if (number >= powers_of_10[n_digits]) {
+		return 0;
+	}
+
+	/*
+	 * Digits in fours from the right, each four split into pairs, the
+	 * rightmost of each pair as it is, and the other doubled.
+	 */
+	sum = 0;
+	for (rest = number; rest != 0; rest /= 10000) {
+		quad = rest % 10000;
+		pair = quad % 100;
+		sum += pair % 10 + luhn10_doubled[pair / 10];
+		pair = quad / 100;
+		sum += pair % 10 + luhn10_doubled[pair / 10];
+	}
+	if (sum % 10 != 0) {
+		return 0;
+	}
+
+	rest = n_digits > N_HEAD ? number / powers_of_10[n_digits - N_HEAD] : number;
+	for (i = n_digits < N_HEAD ? n_digits : N_HEAD; i > 0; i--) {
+		head[i - 1] = '0' + rest % 10;
+		rest /= 10;
+	}
+	head[n_digits < N_HEAD ? n_digits : N_HEAD] = '\0';
+	return card_patterns_match(head, n_digits, valid_types);
+}
@@ -0,0 +1,403 @@
+/*-
+ * Copyright (c) Keith Gaughan, 2007.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "cards.h"
+#include "patterns.h"
+
+/*
+ * The generator works from a plan drawn up from the patterns before it
+ * starts, so that each number costs two draws from the PRNG, a handful of
+ * table lookups and no branches on the pattern data. A type is picked
+ * first, then one of its prefixes and lengths, so that types with lots of
+ * prefixes don't crowd out the rest.
+ *
+ * Each prefix carries its contribution to the Luhn-10 sum for both
+ * parities of length, so only the random digits need summing as they're
+ * written out, and the check digit drops out at the end. The random digits
+ * are written out and summed in pairs, from a table of all hundred.
+ */
+
+struct Pair {
+	char digits[2];
+	/* Luhn-10 sum of the pair, indexed by whether the first is doubled. */
+	unsigned char sums[2];
+};
+
+struct Prefix {
+	char digits[8];
+	unsigned len;
+	/* Luhn-10 sum of the prefix, indexed by the parity of the length. */
+	int sums[2];
+};
+
+struct Choice {
+	unsigned n_prefixes;
+	unsigned n_lengths;
+	struct Prefix* prefixes;
+	unsigned lengths[CARD_MAX_LENGTH + 1];
+};
+
+struct Plan {
+	struct Pair pairs[100];
+	unsigned n_choices;
+	struct Choice choices[N_CARD_PATTERNS];
+	struct Prefix prefixes[128];
+};
+
+
+/* How much each thread generates at a time when writing to a file. */
+#define CHUNK_SIZE (1024 * 1024)
+
+static unsigned
+make_plan(struct Plan* plan, unsigned long valid_types) {
+	const struct CardPattern* pattern;
+	struct Choice* choice;
+	struct Prefix* prefix;
+	char* const* pprefix;
+	unsigned i;
+	unsigned len;
+	unsigned parity;
+	int alt;
+	int j;
+
+	for (i = 0; i < 100; i++) {
+		plan->pairs[i].digits[0] = '0' + i / 10;
+		plan->pairs[i].digits[1] = '0' + i % 10;
+		plan->pairs[i].sums[0] = i / 10 + luhn10_doubled[i % 10];
+		plan->pairs[i].sums[1] = luhn10_doubled[i / 10] + i % 10;
+	}
+
+	plan->n_choices = 0;
+	prefix = plan->prefixes;
+	for (i = 0; i < N_CARD_PATTERNS; i++) {
+		if ((valid_types & (1 << i)) == 0) {
+			continue;
+		}
+		pattern = card_patterns[i];
+		choice = &plan->choices[plan->n_choices++];
+		choice->prefixes = prefix;
+		choice->n_prefixes = 0;
+		for (pprefix = pattern->prefixes; *pprefix != NULL; pprefix++) {
+			prefix->len = strlen(*pprefix);
+			memcpy(prefix->digits, *pprefix, prefix->len);
+			for (parity = 0; parity < 2; parity++) {
+				/*
+				 * In a number of `len' digits, the digit at `j' is doubled
+				 * if there's an odd number of digits after it.
+				 */
+				prefix->sums[parity] = 0;
+				for (j = 0; j < (int) prefix->len; j++) {
+					alt = ((parity + 1 + j) & 1) != 0;
+					prefix->sums[parity] += alt ? luhn10_doubled[*(*pprefix + j) - '0'] : *(*pprefix + j) - '0';
+				}
+			}
+			prefix++;
+			choice->n_prefixes++;
+		}
+		choice->n_lengths = 0;
+		for (len = 0; len <= CARD_MAX_LENGTH; len++) {
+			if ((pattern->lengths & (1 << len)) != 0) {
+				choice->lengths[choice->n_lengths++] = len;
+			}
+		}
+	}
+	return plan->n_choices;
+}
+
+/* splitmix64: small state, fast, and good enough for synthetic data. */
+static inline uint64_t
+next_random(uint64_t* state) {
+	uint64_t z;
+
+	z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/* Maps 16 random bits onto [0, n) without a division. */
+#define PICK(bits, n) ((unsigned) ((((bits) & 0xFFFF) * (n)) >> 16))
+
+/* Random digits written for every number, whatever its length. */
+#define N_PAIRS ((CARD_MAX_LENGTH - 1) / 2)
+
+/* Most that's written past the start of a number: a prefix and the pairs. */
+#define MAX_WRITE (8 + 2 * N_PAIRS)
+
+/*
+ * Writes one number and its newline to `out', returning the end of it.
+ *
+ * The same number of random digits is written every time, two at a time,
+ * with a running Luhn-10 sum kept after each pair; the number's length
+ * then picks which sum counts, and the check digit's written over the
+ * first digit past it. That keeps the loop free of branches that depend on
+ * the length. Pairs come four from each half of one 64-bit draw, by reading
+ * off the decimal digits of each half as a fraction, with the halves worked
+ * on side by side, and the last from the top of the draw that picked the
+ * pattern.
+ */
+static inline char*
+generate_one(char* out, const struct Plan* plan, uint64_t* state) {
+	const struct Choice* choice;
+	const struct Prefix* prefix;
+	const struct Pair* lo;
+	const struct Pair* hi;
+	uint64_t r;
+	uint64_t x_lo;
+	uint64_t x_hi;
+	unsigned len;
+	unsigned n_digits;
+	unsigned alt;
+	unsigned i;
+	int sums[N_PAIRS];
+	int sum;
+	char* digits;
+
+	r = next_random(state);
+	choice = &plan->choices[PICK(r, plan->n_choices)];
+	prefix = &choice->prefixes[PICK(r >> 16, choice->n_prefixes)];
+	len = choice->lengths[PICK(r >> 32, choice->n_lengths)];
+	/* Good for one more pair. */
+	x_hi = (r >> 48) << 16;
+
+	memcpy(out, prefix->digits, 8);
+	digits = out + prefix->len;
+	n_digits = len - prefix->len - 1;
+	alt = n_digits & 1;
+
+	x_hi *= 100;
+	memcpy(digits + 16, plan->pairs[x_hi >> 32].digits, 2);
+
+	r = next_random(state);
+	x_lo = r & 0xFFFFFFFF;
+	x_hi = r >> 32;
+	/* The second half's sums start from nothing, and are caught up after. */
+	sums[0] = prefix->sums[len & 1];
+	sums[4] = 0;
+	for (i = 0; i < 4; i++) {
+		x_lo *= 100;
+		x_hi *= 100;
+		lo = &plan->pairs[x_lo >> 32];
+		hi = &plan->pairs[x_hi >> 32];
+		x_lo &= 0xFFFFFFFF;
+		x_hi &= 0xFFFFFFFF;
+		memcpy(digits + 2 * i, lo->digits, 2);
+		memcpy(digits + 8 + 2 * i, hi->digits, 2);
+		sums[i + 1] = sums[i] + lo->sums[alt];
+		sums[i + 5] = sums[i + 4] + hi->sums[alt];
+	}
+	for (i = 5; i < N_PAIRS; i++) {
+		sums[i] += sums[4];
+	}
+
+	/* An odd one out is the last, so it's doubled. */
+	sum = sums[n_digits / 2] + (n_digits & 1) * luhn10_doubled[digits[n_digits - 1] - '0'];
+	out += len;
+	out[-1] = '0' + (10 - sum % 10) % 10;
+	*out++ = '\n';
+	return out;
+}
+
+static size_t
+fill(const struct Plan* plan, char* buf, size_t cb_buf, size_t max_numbers, uint64_t seed, size_t* n_generated) {
+	char* p;
+	char* last;
+	size_t n;
+
+	/* Numbers are written with room to spare, so leave room for that. */
+	n = 0;
+	p = buf;
+	if (cb_buf >= MAX_WRITE) {
+		last = buf + cb_buf - MAX_WRITE;
+		while (n < max_numbers && p <= last) {
+			p = generate_one(p, plan, &seed);
+			n++;
+		}
+	}
+	if (n_generated != NULL) {
+		*n_generated = n;
+	}
+	return p - buf;
+}
+
+size_t
+card_numbers_fill(char* buf, size_t cb_buf, size_t max_numbers, unsigned long valid_types, unsigned long long seed, size_t* n_generated) {
+	struct Plan plan;
+
+	if (make_plan(&plan, valid_types) == 0) {
+		if (n_generated != NULL) {
+			*n_generated = 0;
+		}
+		return 0;
+	}
+	return fill(&plan, buf, cb_buf, max_numbers, seed, n_generated);
+}
+
+struct Job {
+	const struct Plan* plan;
+	char* buf;
+	size_t cb_buf;
+	size_t max_numbers;
+	uint64_t seed;
+	size_t cb_used;
+	size_t n_generated;
+};
+
+static void*
+run_job(void* arg) {
+	struct Job* job = arg;
+
+	job->cb_used = fill(job->plan, job->buf, job->cb_buf, job->max_numbers, job->seed, &job->n_generated);
+	return NULL;
+}
+
+/*
+ * Splits the buffer and the count evenly between the threads, runs them,
+ * and closes up the gaps each leaves at the end of its share. A thread that
+ * can't be started has its share done on this one instead.
+ */
+static size_t
+fill_parallel(const struct Plan* plan, char* buf, size_t cb_buf, size_t max_numbers, uint64_t seed, unsigned n_threads, size_t* n_generated) {
+	struct Job* jobs;
+	pthread_t* threads;
+	int* started;
+	size_t cb_share;
+	size_t cb_total;
+	size_t n_total;
+	unsigned i;
+
+	if (n_threads < 2 || (jobs = calloc(n_threads, sizeof(*jobs) + sizeof(*threads) + sizeof(*started))) == NULL) {
+		return fill(plan, buf, cb_buf, max_numbers, seed, n_generated);
+	}
+	threads = (pthread_t*) (jobs + n_threads);
+	started = (int*) (threads + n_threads);
+
+	cb_share = cb_buf / n_threads;
+	for (i = 0; i < n_threads; i++) {
+		jobs[i].plan = plan;
+		jobs[i].buf = buf + i * cb_share;
+		jobs[i].cb_buf = cb_share;
+		jobs[i].max_numbers = max_numbers / n_threads + (i < max_numbers % n_threads);
+		/* Step each thread's seed well clear of the others' sequences. */
+		jobs[i].seed = next_random(&seed);
+		started[i] = pthread_create(&threads[i], NULL, run_job, &jobs[i]) == 0;
+	}
+
+	cb_total = 0;
+	n_total = 0;
+	for (i = 0; i < n_threads; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		} else {
+			run_job(&jobs[i]);
+		}
+		if (jobs[i].buf != buf + cb_total) {
+			memmove(buf + cb_total, jobs[i].buf, jobs[i].cb_used);
+		}
+		cb_total += jobs[i].cb_used;
+		n_total += jobs[i].n_generated;
+	}
+	free(jobs);
+
+	if (n_generated != NULL) {
+		*n_generated = n_total;
+	}
+	return cb_total;
+}
+
+size_t
+card_numbers_fill_parallel(char* buf, size_t cb_buf, size_t max_numbers, unsigned long valid_types, unsigned long long seed, unsigned n_threads, size_t* n_generated) {
+	struct Plan plan;
+
+	if (make_plan(&plan, valid_types) == 0) {
+		if (n_generated != NULL) {
+			*n_generated = 0;
+		}
+		return 0;
+	}
+	return fill_parallel(&plan, buf, cb_buf, max_numbers, seed, n_threads, n_generated);
+}
+
+static int
+write_all(int fd, const char* buf, size_t cb) {
+	ssize_t n;
+
+	while (cb > 0) {
+		n = write(fd, buf, cb);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += n;
+		cb -= n;
+	}
+	return 0;
+}
+
+int
+card_numbers_write(int fd, unsigned long long count, unsigned long valid_types, unsigned long long seed, unsigned n_threads) {
+	struct Plan plan;
+	char* buf;
+	size_t cb_buf;
+	size_t cb_used;
+	size_t n;
+	uint64_t state;
+	int result;
+
+	if (make_plan(&plan, valid_types) == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (n_threads < 1) {
+		n_threads = 1;
+	}
+	cb_buf = (size_t) n_threads * CHUNK_SIZE;
+	buf = malloc(cb_buf);
+	if (buf == NULL) {
+		return -1;
+	}
+
+	result = 0;
+	state = seed;
+	while (count > 0) {
+		cb_used = fill_parallel(&plan, buf, cb_buf, count < cb_buf ? (size_t) count : cb_buf, next_random(&state), n_threads, &n);
+		if (write_all(fd, buf, cb_used) == -1) {
+			result = -1;
+			break;
+		}
+		count -= n;
+	}
+	free(buf);
+	return result;
+}
@@ -0,0 +1,360 @@
+/*-
+ * Copyright (c) Keith Gaughan, 2007.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "cards.h"
+
+/*
+ * A hotlist file is laid out so it can be used straight from the page
+ * cache, with nothing to read in or build when it's opened:
+ *
+ *   header     64 bytes, as below
+ *   filter     blocked Bloom filter, 64 bytes to a block (optional)
+ *   directory  (1 << bucket_bits) + 1 offsets into the keys, 32 bits each
+ *   keys       the numbers, 64 bits each, grouped by bucket
+ *
+ * Each number's hashed, the top bits of the hash pick its bucket, and the
+ * directory gives where the bucket's keys start and end, so a lookup is
+ * two cache misses: one into the directory, and one into the keys. With
+ * four keys to a bucket on average, there's no need to order them within
+ * it. The filter takes one more miss, but saves the other two for most
+ * numbers that aren't there, and most numbers checked won't be.
+ *
+ * Everything's in the byte order of the machine that built it.
+ */
+
+#define HOTLIST_MAGIC    "CHOT"
+#define HOTLIST_VERSION  1
+#define HEADER_SIZE      64
+#define BLOCK_SIZE       64
+#define BLOCK_BITS       (BLOCK_SIZE * 8)
+#define KEYS_PER_BUCKET  4
+#define MAX_PROBES       7
+
+struct Header {
+	char magic[4];
+	uint32_t version;
+	uint64_t n_keys;
+	uint32_t bucket_bits;
+	uint32_t n_blocks;
+	uint32_t n_probes;
+	uint32_t reserved;
+	uint64_t directory_offset;
+	uint64_t keys_offset;
+	uint64_t file_size;
+	char padding[8];
+};
+
+/* If this fails to compile, the header's grown. */
+typedef char header_size_check[sizeof(struct Header) == HEADER_SIZE ? 1 : -1];
+
+struct CardHotlist {
+	const unsigned char* base;
+	size_t size;
+	const uint64_t* blocks;
+	const uint32_t* directory;
+	const uint64_t* keys;
+	unsigned bucket_bits;
+	uint32_t n_blocks;
+	unsigned n_probes;
+};
+
+/* The splitmix64 finaliser, which mixes well enough for clustered keys. */
+static inline uint64_t
+mix(uint64_t z) {
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static inline uint64_t
+bucket_of(uint64_t hash, unsigned bucket_bits) {
+	return bucket_bits == 0 ? 0 : hash >> (64 - bucket_bits);
+}
+
+/*
+ * The filter uses the low half of the hash to pick a block, and a second
+ * hash for the bits in it, nine to a bit.
+ */
+static inline uint64_t*
+block_of(const uint64_t* blocks, uint32_t n_blocks, uint64_t hash) {
+	return (uint64_t*) blocks + ((hash & 0xFFFFFFFF) * n_blocks >> 32) * (BLOCK_SIZE / 8);
+}
+
+int
+card_hotlist_build(const char* path, const unsigned long long* numbers, size_t n_numbers, unsigned bloom_bits_per_key) {
+	struct Header header;
+	uint64_t* keys;
+	uint32_t* directory;
+	uint64_t* blocks;
+	uint64_t* block;
+	uint64_t hash;
+	uint64_t bits;
+	size_t n_buckets;
+	size_t n_keys;
+	size_t cb_blocks;
+	size_t cb_directory;
+	size_t cb_padding;
+	size_t i;
+	size_t j;
+	size_t k;
+	uint32_t start;
+	unsigned probe;
+	char tmp[1024];
+	FILE* fp;
+	int ok;
+
+	if (n_numbers > UINT32_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HOTLIST_MAGIC, 4);
+	header.version = HOTLIST_VERSION;
+	while (((size_t) 1 << header.bucket_bits) * KEYS_PER_BUCKET < n_numbers) {
+		header.bucket_bits++;
+	}
+	n_buckets = (size_t) 1 << header.bucket_bits;
+
+	/* Counting sort into buckets, with the directory as the counts. */
+	directory = calloc(n_buckets + 1, sizeof(*directory));
+	keys = malloc((n_numbers > 0 ? n_numbers : 1) * sizeof(*keys));
+	if (directory == NULL || keys == NULL) {
+		free(directory);
+		free(keys);
+		return -1;
+	}
+	for (i = 0; i < n_numbers; i++) {
+		directory[bucket_of(mix(numbers[i]), header.bucket_bits) + 1]++;
+	}
+	for (i = 0; i < n_buckets; i++) {
+		directory[i + 1] += directory[i];
+	}
+	for (i = 0; i < n_numbers; i++) {
+		keys[directory[bucket_of(mix(numbers[i]), header.bucket_bits)]++] = numbers[i];
+	}
+	/* Placing them moved each bucket's start along to the next's. */
+	memmove(directory + 1, directory, n_buckets * sizeof(*directory));
+	directory[0] = 0;
+
+	/* Squeeze out any duplicates. */
+	n_keys = 0;
+	for (i = 0; i < n_buckets; i++) {
+		start = n_keys;
+		for (j = directory[i]; j < directory[i + 1]; j++) {
+			for (k = start; k < n_keys && keys[k] != keys[j]; k++) {
+			}
+			if (k == n_keys) {
+				keys[n_keys++] = keys[j];
+			}
+		}
+		directory[i] = start;
+	}
+	directory[n_buckets] = n_keys;
+	header.n_keys = n_keys;
+
+	blocks = NULL;
+	cb_blocks = 0;
+	if (bloom_bits_per_key > 0 && n_keys > 0) {
+		header.n_blocks = (n_keys * bloom_bits_per_key + BLOCK_BITS - 1) / BLOCK_BITS;
+		/* Roughly ln 2 probes a bit per key is best. */
+		header.n_probes = (bloom_bits_per_key * 69 + 50) / 100;
+		if (header.n_probes < 1) {
+			header.n_probes = 1;
+		} else if (header.n_probes > MAX_PROBES) {
+			header.n_probes = MAX_PROBES;
+		}
+		cb_blocks = (size_t) header.n_blocks * BLOCK_SIZE;
+		blocks = calloc(1, cb_blocks);
+		if (blocks == NULL) {
+			free(directory);
+			free(keys);
+			return -1;
+		}
+		for (i = 0; i < n_keys; i++) {
+			hash = mix(keys[i]);
+			block = block_of(blocks, header.n_blocks, hash);
+			bits = mix(hash);
+			for (probe = 0; probe < header.n_probes; probe++, bits >>= 9) {
+				block[(bits & 511) >> 6] |= (uint64_t) 1 << (bits & 63);
+			}
+		}
+	}
+
+	cb_directory = (n_buckets + 1) * sizeof(*directory);
+	header.directory_offset = HEADER_SIZE + cb_blocks;
+	/* Keep the keys aligned. */
+	header.keys_offset = (header.directory_offset + cb_directory + 7) & ~(uint64_t) 7;
+	header.file_size = header.keys_offset + n_keys * sizeof(*keys);
+	cb_padding = header.keys_offset - header.directory_offset - cb_directory;
+
+	/* Written aside and moved into place, so readers never see half a list. */
+	snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long) getpid());
+	fp = fopen(tmp, "wb");
+	ok = fp != NULL;
+	if (ok) {
+		ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+			(cb_blocks == 0 || fwrite(blocks, cb_blocks, 1, fp) == 1) &&
+			fwrite(directory, cb_directory, 1, fp) == 1 &&
+			(cb_padding == 0 || fwrite("\0\0\0\0\0\0\0", cb_padding, 1, fp) == 1) &&
+			(n_keys == 0 || fwrite(keys, n_keys * sizeof(*keys), 1, fp) == 1);
+		ok = fclose(fp) == 0 && ok;
+		if (ok) {
+			ok = rename(tmp, path) == 0;
+		}
+		if (!ok) {
+			unlink(tmp);
+		}
+	}
+
+	free(blocks);
+	free(directory);
+	free(keys);
+	return ok ? 0 : -1;
+}
+
+struct CardHotlist*
+card_hotlist_open(const char* path, int flags) {
+	struct CardHotlist* hotlist;
+	const struct Header* header;
+	struct stat st;
+	void* base;
+	int mmap_flags;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t) st.st_size < HEADER_SIZE) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	mmap_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	if (flags & CARD_HOTLIST_PRELOAD) {
+		mmap_flags |= MAP_POPULATE;
+	}
+#endif
+	base = mmap(NULL, st.st_size, PROT_READ, mmap_flags, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+
+	header = base;
+	if (memcmp(header->magic, HOTLIST_MAGIC, 4) != 0 || header->version != HOTLIST_VERSION ||
+			header->file_size != (uint64_t) st.st_size || header->bucket_bits > 32 ||
+			header->n_probes > MAX_PROBES ||
+			header->directory_offset != HEADER_SIZE + (uint64_t) header->n_blocks * BLOCK_SIZE ||
+			header->keys_offset < header->directory_offset + (((uint64_t) 1 << header->bucket_bits) + 1) * 4 ||
+			header->keys_offset % 8 != 0 || header->n_keys > header->file_size / 8 ||
+			header->keys_offset + header->n_keys * 8 != header->file_size) {
+		munmap(base, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	hotlist = malloc(sizeof(*hotlist));
+	if (hotlist == NULL) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	hotlist->base = base;
+	hotlist->size = st.st_size;
+	hotlist->blocks = (const uint64_t*) (hotlist->base + HEADER_SIZE);
+	hotlist->directory = (const uint32_t*) (hotlist->base + header->directory_offset);
+	hotlist->keys = (const uint64_t*) (hotlist->base + header->keys_offset);
+	hotlist->bucket_bits = header->bucket_bits;
+	hotlist->n_blocks = header->n_blocks;
+	hotlist->n_probes = header->n_probes;
+	if ((flags & CARD_HOTLIST_PRELOAD) == 0) {
+		/* Lookups are all over the place, so reading ahead's a waste. */
+		madvise(base, st.st_size, MADV_RANDOM);
+	}
+	return hotlist;
+}
+
+int
+card_hotlist_contains(const struct CardHotlist* hotlist, unsigned long long number) {
+	const uint64_t* block;
+	const uint64_t* key;
+	const uint64_t* end;
+	uint64_t hash;
+	uint64_t bits;
+	uint64_t bucket;
+	unsigned probe;
+
+	hash = mix(number);
+	if (hotlist->n_blocks > 0) {
+		block = block_of(hotlist->blocks, hotlist->n_blocks, hash);
+		bits = mix(hash);
+		for (probe = 0; probe < hotlist->n_probes; probe++, bits >>= 9) {
+			if ((block[(bits & 511) >> 6] & ((uint64_t) 1 << (bits & 63))) == 0) {
+				return 0;
+			}
+		}
+	}
+
+	bucket = bucket_of(hash, hotlist->bucket_bits);
+	end = hotlist->keys + hotlist->directory[bucket + 1];
+	for (key = hotlist->keys + hotlist->directory[bucket]; key < end; key++) {
+		if (*key == number) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+size_t
+card_hotlist_size(const struct CardHotlist* hotlist) {
+	return ((const struct Header*) hotlist->base)->n_keys;
+}
+
+void
+card_hotlist_close(struct CardHotlist* hotlist) {
+	if (hotlist != NULL) {
+		munmap((void*) hotlist->base, hotlist->size);
+		free(hotlist);
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef TALIDEON_CARDS__patterns_h
+#define TALIDEON_CARDS__patterns_h
+/*-
+ * Copyright (c) Keith Gaughan, 2007.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Internals shared between the parts of the library. Not installed.
+ */
+
+#include "cards.h"
+
+struct CardPattern {
+	/* Each bit that's set indicates a valid length. */
+	unsigned long lengths;
+	/* List of prefixes. */
+	char* prefixes[];
+};
+
+/* The longest card number any pattern allows. */
+#define CARD_MAX_LENGTH 19
+
+/* The longest prefix any pattern has. */
+#define CARD_BIN_DIGITS 6
+
+/* One per bit of the CARDPAT_* masks, in bit order. */
+#define N_CARD_PATTERNS CARDPAT_COUNT
+
+BEGIN_C_DECLS
+
+extern const struct CardPattern * const card_patterns[N_CARD_PATTERNS];
+
+/* Each digit doubled, with the digits of the result summed. */
+extern const int luhn10_doubled[10];
+
+/*
+ * Sums the digits of a number the Luhn-10 way, doubling every second digit
+ * from the right, starting with the rightmost if `alt' is set. Returns the
+ * sum modulo 10, or -1 if there's anything but digits in it.
+ */
+extern int luhn10_sum(const char* number, size_t len, int alt);
+
+/* Checks if `s' starts with `prefix'. */
+extern int is_prefixed_by(const char* s, const char* prefix);
+
+/*
+ * Finds the first of the given types whose lengths and prefixes match a
+ * number of `len' digits, returning its bit, or 0 if none do. Doesn't check
+ * the checksum, and only the first CARD_BIN_DIGITS digits are looked at. It
+ * goes through the calling thread's BIN cache if the cache is turned on.
+ */
+extern unsigned long card_patterns_match(const char* scrubbed_number, unsigned len, unsigned long valid_types);
+
+/* As card_patterns_match(), but always walks the patterns. */
+extern unsigned long card_patterns_match_uncached(const char* scrubbed_number, unsigned len, unsigned long valid_types);
+
+/* As card_patterns_match(), through the calling thread's BIN cache. */
+extern unsigned long card_bin_cache_match(const char* scrubbed_number, unsigned len, unsigned long valid_types);
+
+/* Set if card_patterns_match() should use the BIN cache. */
+extern int card_bin_cache_on;
+
+END_C_DECLS
+
+#endif /* !TALIDEON_CARDS__patterns_h */
@@ -0,0 +1,131 @@
+/*-
+ * Copyright (c) Keith Gaughan, 2007.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cards.h"
+#include "patterns.h"
+
+/*
+ * Scrubbing and checking are done in the one pass from left to right. As
+ * which digits get doubled depends on where the number ends, a Luhn-10 sum
+ * is kept for both possibilities, one in each of the two low bytes of the
+ * accumulator, and the right one is picked at the end. Nineteen digits sum
+ * to no more than 171, so neither can overflow into the other.
+ */
+static const unsigned luhn10_both[2][10] = {
+	{ 0x000, 0x201, 0x402, 0x603, 0x804, 0x105, 0x306, 0x507, 0x708, 0x909 },
+	{ 0x000, 0x102, 0x204, 0x306, 0x408, 0x501, 0x603, 0x705, 0x807, 0x909 }
+};
+
+static inline int
+is_separator(char ch) {
+	return ch == ' ' || ch == '-' || ch == '.';
+}
+
+unsigned long
+card_number_scrub_and_check(const char* raw_number, size_t len, char* scrubbed, size_t cb_scrubbed, unsigned long valid_types) {
+	const char* pch;
+	const char* end;
+	unsigned acc;
+	unsigned n;
+	unsigned max;
+#ifdef __SSE2__
+	__m128i v;
+	unsigned digits;
+	unsigned separators;
+	unsigned i;
+#endif
+
+	if (cb_scrubbed == 0) {
+		return 0;
+	}
+	max = cb_scrubbed - 1 < CARD_MAX_LENGTH ? cb_scrubbed - 1 : CARD_MAX_LENGTH;
+
+	pch = raw_number;
+	end = raw_number + len;
+	while (pch < end && isspace((unsigned char) *pch)) {
+		pch++;
+	}
+	while (end > pch && isspace((unsigned char) end[-1])) {
+		end--;
+	}
+
+	acc = 0;
+	n = 0;
+#ifdef __SSE2__
+	/*
+	 * Sixteen bytes at a time, sort out which are digits and which are
+	 * separators, then pick the digits out by their bits.
+	 */
+	while (end - pch >= 16) {
+		v = _mm_loadu_si128((const __m128i*) pch);
+		digits = _mm_movemask_epi8(_mm_and_si128(
+					_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+					_mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))));
+		separators = _mm_movemask_epi8(_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('-'))),
+					_mm_cmpeq_epi8(v, _mm_set1_epi8('.'))));
+		if ((digits | separators) != 0xFFFF) {
+			return 0;
+		}
+		while (digits != 0) {
+			if (n == max) {
+				return 0;
+			}
+			i = __builtin_ctz(digits);
+			scrubbed[n] = pch[i];
+			acc += luhn10_both[n & 1][pch[i] - '0'];
+			n++;
+			digits &= digits - 1;
+		}
+		pch += 16;
+	}
+#endif
+	for (; pch < end; pch++) {
+		if (*pch >= '0' && *pch <= '9') {
+			if (n == max) {
+				return 0;
+			}
+			scrubbed[n] = *pch;
+			acc += luhn10_both[n & 1][*pch - '0'];
+			n++;
+		} else if (!is_separator(*pch)) {
+			return 0;
+		}
+	}
+	scrubbed[n] = '\0';
+
+	/* The rightmost digit isn't doubled, and which sum that is depends on the length. */
+	if (n < 2 || ((acc >> ((n & 1) ? 0 : 8)) & 0xFF) % 10 != 0) {
+		return 0;
+	}
+	return card_patterns_match(scrubbed, n, valid_types);
+}
@@ -0,0 +1,194 @@
+/*-
+ * Copyright (c) Keith Gaughan, 2007.
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+
+#include "cards.h"
+#include "patterns.h"
+
+/*
+ * Each thread counts into its own block, which is never written by any other
+ * thread and is aligned to a cache line so it never shares one with any
+ * other block. Counting's then a plain load, add and store, with no locked
+ * instructions and no cache lines bouncing between cores; the atomic builtins
+ * are only there so that card_stats_get() can't see a counter half-written.
+ *
+ * The blocks are kept on a list, and the lock's only taken to add a thread's
+ * block to it, to take it off when the thread exits, and to add them up.
+ * When a thread exits, what it counted is kept in `retired'.
+ */
+
+#define CACHE_LINE 64
+
+struct Counters {
+	struct CardStats stats;
+	struct Counters* prev;
+	struct Counters* next;
+} __attribute__((aligned(CACHE_LINE)));
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+static struct Counters* live;
+static struct CardStats retired;
+static __thread struct Counters* counters;
+
+#define BUMP(counter) \
+	__atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED)
+
+static void
+add_stats(struct CardStats* total, const struct CardStats* stats) {
+	unsigned i;
+
+	for (i = 0; i < CARDPAT_COUNT; i++) {
+		total->types[i] += __atomic_load_n(&stats->types[i], __ATOMIC_RELAXED);
+	}
+	for (i = 0; i < CARDCHK_COUNT; i++) {
+		total->reasons[i] += __atomic_load_n(&stats->reasons[i], __ATOMIC_RELAXED);
+	}
+}
+
+static void
+retire_counters(void* arg) {
+	struct Counters* c = arg;
+
+	pthread_mutex_lock(&lock);
+	add_stats(&retired, &c->stats);
+	if (c->prev != NULL) {
+		c->prev->next = c->next;
+	} else {
+		live = c->next;
+	}
+	if (c->next != NULL) {
+		c->next->prev = c->prev;
+	}
+	pthread_mutex_unlock(&lock);
+	free(c);
+}
+
+static void
+make_key(void) {
+	pthread_key_create(&key, retire_counters);
+}
+
+/*
+ * Gets the calling thread's counters, setting them up if this is the first
+ * time it's counted anything. Returns NULL if they can't be, in which case
+ * nothing's counted.
+ */
+static struct Counters*
+get_counters(void) {
+	struct Counters* c;
+
+	if (counters != NULL) {
+		return counters;
+	}
+	pthread_once(&key_once, make_key);
+	if (posix_memalign((void**) &c, CACHE_LINE, sizeof(*c)) != 0) {
+		return NULL;
+	}
+	memset(c, 0, sizeof(*c));
+	pthread_mutex_lock(&lock);
+	c->next = live;
+	if (live != NULL) {
+		live->prev = c;
+	}
+	live = c;
+	pthread_mutex_unlock(&lock);
+	pthread_setspecific(key, c);
+	counters = c;
+	return c;
+}
+
+/*
+ * Tells a number that starts like one of the types asked for, but is the
+ * wrong length, apart from one that doesn't start like any of them. Only
+ * done once card_patterns_match() has failed, so the numbers that pass pay
+ * nothing for it.
+ */
+static int
+why_unmatched(const char* scrubbed_number, unsigned long valid_types) {
+	unsigned i;
+	char* const* pprefix;
+
+	for (i = 0; i < N_CARD_PATTERNS; i++) {
+		if ((valid_types & (1 << i)) != 0) {
+			for (pprefix = card_patterns[i]->prefixes; *pprefix != NULL; pprefix++) {
+				if (is_prefixed_by(scrubbed_number, *pprefix)) {
+					return CARDCHK_WRONG_LENGTH;
+				}
+			}
+		}
+	}
+	return CARDCHK_UNKNOWN_PREFIX;
+}
+
+unsigned long
+card_number_check(const char* scrubbed_number, unsigned long valid_types, int* reason) {
+	struct Counters* c;
+	unsigned long type;
+	size_t len;
+	int sum;
+	int why;
+
+	type = 0;
+	len = strlen(scrubbed_number);
+	sum = luhn10_sum(scrubbed_number, len, 0);
+	if (sum < 0) {
+		why = CARDCHK_NOT_DIGITS;
+	} else if (len < 2 || sum != 0) {
+		why = CARDCHK_BAD_CHECKSUM;
+	} else if (len > CARD_MAX_LENGTH || (type = card_patterns_match(scrubbed_number, len, valid_types)) == 0) {
+		why = why_unmatched(scrubbed_number, valid_types);
+	} else {
+		why = CARDCHK_OK;
+	}
+
+	c = get_counters();
+	if (c != NULL) {
+		BUMP(c->stats.reasons[why]);
+		if (type != 0) {
+			BUMP(c->stats.types[__builtin_ctzl(type)]);
+		}
+	}
+	if (reason != NULL) {
+		*reason = why;
+	}
+	return type;
+}
+
+void
+card_stats_get(struct CardStats* stats) {
+	const struct Counters* c;
+
+	pthread_mutex_lock(&lock);
+	*stats = retired;
+	for (c = live; c != NULL; c = c->next) {
+		add_stats(stats, &c->stats);
+	}
+	pthread_mutex_unlock(&lock);
+}
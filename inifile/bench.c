@@ -0,0 +1,270 @@
+/*                                       vim:set ts=4 sw=4 noai sr sta et cin:
+ * Benchmarking driver for inifile.
+ * This file is in the Public Domain.
+ *
+ * Usage: bench [-l] [-n ops] [-r seed] <file.ini>
+ *
+ * -l loads the file with INI_LoadLazy() rather than INI_Load().
+ *
+ * The file's copied first, as INI_Save() writes back to wherever the file
+ * was loaded from. Results go to stdout as `metric<TAB>value<TAB>unit'
+ * lines so they can be collected up and compared between runs; lines
+ * starting with `#' are commentary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "inifile.h"
+
+typedef struct
+{
+    char* section;
+    char* key;
+} Pair;
+
+static unsigned long state = 2463534242UL;
+
+static unsigned long Random(unsigned long n)
+{
+    state ^= (state << 13) & 0xFFFFFFFFUL;
+    state ^= state >> 17;
+    state ^= (state << 5) & 0xFFFFFFFFUL;
+    return n == 0 ? 0 : state % n;
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void Report(const char* metric, double value, const char* unit)
+{
+    printf("%s\t%.6f\t%s\n", metric, value, unit);
+}
+
+static void ReportRate(const char* op, unsigned long n, double secs)
+{
+    char metric[64];
+
+    sprintf(metric, "%s_secs", op);
+    Report(metric, secs, "s");
+    sprintf(metric, "%s_rate", op);
+    Report(metric, secs > 0 ? n / secs : 0, "ops/s");
+}
+
+static char* CopyString(const char* s)
+{
+    char* pNew;
+
+    pNew = malloc(strlen(s) + 1);
+    if (pNew == NULL)
+    {
+        perror("bench");
+        exit(EXIT_FAILURE);
+    }
+    return strcpy(pNew, s);
+}
+
+static long CopyFile(const char* from, const char* to)
+{
+    FILE*  fin;
+    FILE*  fout;
+    char   buf[65536];
+    size_t n;
+    long   total;
+
+    fin = fopen(from, "rb");
+    if (fin == NULL)
+        return -1;
+    fout = fopen(to, "wb");
+    if (fout == NULL)
+    {
+        fclose(fin);
+        return -1;
+    }
+
+    total = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fin)) > 0)
+    {
+        fwrite(buf, 1, n, fout);
+        total += (long) n;
+    }
+
+    fclose(fin);
+    if (fclose(fout) != 0)
+        return -1;
+    return total;
+}
+
+int main(int argc, char** argv)
+{
+    INIFile*      ini;
+    struct rusage ru;
+    char          path[4096];
+    char          newKey[32];
+    char**        sections;
+    char**        entries;
+    Pair*         pairs;
+    size_t        nSects;
+    size_t        nEntries;
+    size_t        nPairs;
+    size_t        iSect;
+    size_t        iEntry;
+    unsigned long nOps;
+    unsigned long iOp;
+    unsigned long nHits;
+    long          nBytes;
+    double        started;
+    int           iArg;
+    int           lazy;
+
+    nOps = 10000;
+    lazy = 0;
+    for (iArg = 1; iArg < argc - 1; iArg++)
+    {
+        if (strcmp(argv[iArg], "-l") == 0)
+            lazy = 1;
+        else if (strcmp(argv[iArg], "-n") == 0 && iArg + 2 < argc)
+            nOps = strtoul(argv[++iArg], NULL, 10);
+        else if (strcmp(argv[iArg], "-r") == 0 && iArg + 2 < argc)
+            state = strtoul(argv[++iArg], NULL, 10) | 1;
+        else
+            break;
+    }
+    if (iArg + 1 != argc || strlen(argv[iArg]) + 7 > sizeof(path))
+    {
+        fprintf(stderr, "Usage: %s [-l] [-n ops] [-r seed] <file.ini>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    sprintf(path, "%s.bench", argv[iArg]);
+    nBytes = CopyFile(argv[iArg], path);
+    if (nBytes < 0)
+    {
+        perror("bench");
+        return EXIT_FAILURE;
+    }
+
+    printf("# file\t%s\n", argv[iArg]);
+    Report("file_bytes", nBytes, "B");
+
+    /* Load. */
+    started = Now();
+    ini = lazy ? INI_LoadLazy(path) : INI_Load(path);
+    if (ini == NULL)
+    {
+        remove(path);
+        return EXIT_FAILURE;
+    }
+    started = Now() - started;
+    ReportRate("load", 1, started);
+    Report("load_throughput", started > 0 ? nBytes / started / (1024 * 1024) : 0, "MiB/s");
+    getrusage(RUSAGE_SELF, &ru);
+    Report("load_rss", (double) ru.ru_maxrss, "KiB");
+
+    /*
+     * Iterate. This walks every section and entry through the public
+     * interface, and keeps a copy of every key for the random operations.
+     */
+    started = Now();
+    nSects = INI_SectionCount(ini);
+    sections = (char**) malloc((nSects + 1) * sizeof(char*));
+    pairs = NULL;
+    nPairs = 0;
+    INI_ListSections(ini, sections);
+    for (iSect = 0; iSect < nSects; iSect++)
+    {
+        nEntries = INI_EntryCount(ini, sections[iSect]);
+        entries = (char**) malloc((nEntries + 1) * sizeof(char*));
+        pairs = (Pair*) realloc(pairs, (nPairs + nEntries + 1) * sizeof(Pair));
+        if (entries == NULL || pairs == NULL)
+        {
+            perror("bench");
+            return EXIT_FAILURE;
+        }
+        INI_ListEntries(ini, sections[iSect], entries);
+        for (iEntry = 0; iEntry < nEntries; iEntry++)
+        {
+            pairs[nPairs].section = CopyString(sections[iSect]);
+            pairs[nPairs].key     = CopyString(entries[iEntry]);
+            nPairs++;
+        }
+        free(entries);
+    }
+    free(sections);
+    ReportRate("iterate", (unsigned long) nPairs, Now() - started);
+    Report("sections", nSects, "");
+    Report("entries", nPairs, "");
+
+    if (nPairs == 0)
+    {
+        fprintf(stderr, "Nothing to benchmark in %s.\n", argv[iArg]);
+        INI_Free(ini);
+        remove(path);
+        return EXIT_FAILURE;
+    }
+
+    /* Random reads. */
+    nHits = 0;
+    started = Now();
+    for (iOp = 0; iOp < nOps; iOp++)
+    {
+        iEntry = Random(nPairs);
+        if (INI_Read(ini, pairs[iEntry].section, pairs[iEntry].key) != NULL)
+            nHits++;
+    }
+    ReportRate("read", nOps, Now() - started);
+    if (nHits != nOps)
+        printf("# read\t%lu of %lu keys went missing\n", nOps - nHits, nOps);
+
+    /* Writes: half overwrite existing keys, half add new ones. */
+    started = Now();
+    for (iOp = 0; iOp < nOps; iOp++)
+    {
+        iEntry = Random(nPairs);
+        if (iOp % 2 == 0)
+        {
+            INI_Write(ini, pairs[iEntry].section, pairs[iEntry].key, "overwritten");
+        }
+        else
+        {
+            sprintf(newKey, "bench%lu", iOp);
+            INI_Write(ini, pairs[iEntry].section, newKey, "added");
+        }
+    }
+    ReportRate("write", nOps, Now() - started);
+
+    /* Deletes. The same key may come up twice, which is fine. */
+    started = Now();
+    for (iOp = 0; iOp < nOps; iOp++)
+    {
+        iEntry = Random(nPairs);
+        INI_DeleteEntry(ini, pairs[iEntry].section, pairs[iEntry].key);
+    }
+    ReportRate("delete", nOps, Now() - started);
+
+    /* Save. */
+    started = Now();
+    INI_Save(ini);
+    ReportRate("save", 1, Now() - started);
+
+    getrusage(RUSAGE_SELF, &ru);
+    Report("peak_rss", (double) ru.ru_maxrss, "KiB");
+
+    INI_Free(ini);
+    remove(path);
+    for (iEntry = 0; iEntry < nPairs; iEntry++)
+    {
+        free(pairs[iEntry].section);
+        free(pairs[iEntry].key);
+    }
+    free(pairs);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Runs the inifile benchmarks over a corpus of generated files.
+# This file is in the Public Domain.
+#
+# Usage: bench.sh [sizes...]
+#
+# Each result line is prefixed with the size of file it came from, so the
+# output of several runs can be diffed or fed to a spreadsheet. Set OPS to
+# change how many reads, writes and deletes are done on each file, and
+# CORPUS to keep the generated files somewhere other than a temporary
+# directory.
+
+set -e
+
+cd "$(dirname "$0")"
+cc ${CFLAGS:--O2} -o genini genini.c
+cc ${CFLAGS:--O2} -o bench bench.c inifile.c
+
+corpus=${CORPUS:-$(mktemp -d)}
+[ $# -gt 0 ] || set -- 1K 64K 1M 16M
+
+for size in "$@"; do
+    # Few big sections, lots of small ones, and long values.
+    for shape in "-S 10 -k 16 -v 32" "-S 1000 -k 16 -v 32" "-S 100 -k 48 -v 512"; do
+        file="$corpus/$size-$(echo "$shape" | tr -d ' -').ini"
+        [ -f "$file" ] || ./genini -s "$size" $shape > "$file"
+        # Not every sed knows \t, so the tabs go in as they are.
+        prefix=$(printf '%s\t%s\t' "$size" "$(echo "$shape" | tr -d ' ')")
+        ./bench -n "${OPS:-1000}" "$file" | sed "s|^|$prefix|"
+    done
+done
+
+[ -n "$CORPUS" ] || rm -rf "$corpus"
@@ -5,11 +5,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "inifile.h"
 
 int main(void)
 {
     INIFile* ini;
+    FILE*    fp;
+    char     buf[64];
+    int      kept;
 
     ini = INI_Load("test.ini");
     if (ini != NULL)
@@ -51,6 +55,7 @@ int main(void)
             puts("Bugger!");
 
         INI_Save(ini);
+        INI_DumpStats(ini);
         INI_Free(ini);
     }
 
@@ -58,6 +63,33 @@ int main(void)
     if (ini != NULL)
         INI_Free(ini);
 
+    /* A section cut short by a bad line mustn't be saved without the rest. */
+    fp = fopen("broken.ini", "wt");
+    if (fp != NULL)
+    {
+        fputs("[s1]\nk=v\n[s2]\nk=v\nbad line\nk2=v2\n", fp);
+        fclose(fp);
+    }
+    ini = INI_LoadLazy("broken.ini");
+    if (ini != NULL)
+    {
+        INI_Read(ini, "s2", "k");
+        INI_Save(ini);
+        INI_Save(ini);
+        INI_Free(ini);
+    }
+    kept = 0;
+    fp = fopen("broken.ini", "rt");
+    if (fp != NULL)
+    {
+        while (fgets(buf, sizeof(buf), fp) != NULL)
+            if (strcmp(buf, "k2=v2\n") == 0)
+                kept = 1;
+        fclose(fp);
+    }
+    remove("broken.ini");
+    puts(kept ? "Broken section kept!" : "Bugger!");
+
     return EXIT_SUCCESS;
 }
 
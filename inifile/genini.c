@@ -0,0 +1,123 @@
+/*                                       vim:set ts=4 sw=4 noai sr sta et cin:
+ * Generates .ini files for benchmarking inifile.
+ * This file is in the Public Domain.
+ *
+ * Usage: genini [-s size] [-S sections] [-k keylen] [-v vallen] [-r seed]
+ *
+ * The file's written to stdout. Sizes may have a K, M, or G suffix. Key and
+ * value lengths are maxima: each one's picked at random up to that, so the
+ * lines look more like real configuration than a wall of identical ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lines must stay under INI_Load()'s limit of 4096 bytes. */
+#define MAX_KEY 1024
+#define MAX_VAL 2048
+
+static unsigned long state = 2463534242UL;
+
+/* Marsaglia's xorshift. Plenty random enough, and repeatable. */
+static unsigned long Random(unsigned long n)
+{
+    state ^= (state << 13) & 0xFFFFFFFFUL;
+    state ^= state >> 17;
+    state ^= (state << 5) & 0xFFFFFFFFUL;
+    return n == 0 ? 0 : state % n;
+}
+
+static double ParseSize(const char* s)
+{
+    char*  end;
+    double n;
+
+    n = strtod(s, &end);
+    switch (*end)
+    {
+    case 'G': case 'g': n *= 1024; /* FALLTHROUGH */
+    case 'M': case 'm': n *= 1024; /* FALLTHROUGH */
+    case 'K': case 'k': n *= 1024;
+    }
+    return n;
+}
+
+static void Word(char* buf, unsigned long len)
+{
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz_.";
+    unsigned long i;
+
+    /* Don't start with a dot, to keep it looking sensible. */
+    for (i = 0; i < len; i++)
+        buf[i] = letters[Random(i == 0 ? 26 : sizeof(letters) - 1)];
+    buf[len] = '\0';
+}
+
+int main(int argc, char** argv)
+{
+    char          key[MAX_KEY + 1];
+    char          val[MAX_VAL + 1];
+    double        target;
+    double        written;
+    unsigned long nSects;
+    unsigned long maxKey;
+    unsigned long maxVal;
+    unsigned long perSect;
+    unsigned long iSect;
+    unsigned long iEntry;
+    int           iArg;
+
+    target = 1024 * 1024;
+    nSects = 100;
+    maxKey = 24;
+    maxVal = 64;
+
+    for (iArg = 1; iArg + 1 < argc; iArg += 2)
+    {
+        if (strcmp(argv[iArg], "-s") == 0)
+            target = ParseSize(argv[iArg + 1]);
+        else if (strcmp(argv[iArg], "-S") == 0)
+            nSects = strtoul(argv[iArg + 1], NULL, 10);
+        else if (strcmp(argv[iArg], "-k") == 0)
+            maxKey = strtoul(argv[iArg + 1], NULL, 10);
+        else if (strcmp(argv[iArg], "-v") == 0)
+            maxVal = strtoul(argv[iArg + 1], NULL, 10);
+        else if (strcmp(argv[iArg], "-r") == 0)
+            state = strtoul(argv[iArg + 1], NULL, 10) | 1;
+        else
+            break;
+    }
+    if (iArg != argc || nSects == 0 || maxKey == 0)
+    {
+        fprintf(stderr, "Usage: %s [-s size] [-S sections] [-k keylen] [-v vallen] [-r seed]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (maxKey > MAX_KEY)
+        maxKey = MAX_KEY;
+    if (maxVal > MAX_VAL)
+        maxVal = MAX_VAL;
+
+    /* Work out roughly how many entries each section needs. */
+    perSect = (unsigned long) (target / nSects / ((maxKey + maxVal) / 2.0 + 10));
+    if (perSect == 0)
+        perSect = 1;
+
+    written = fprintf(stdout, "; Generated by genini.\n");
+    for (iSect = 0; iSect < nSects && written < target; iSect++)
+    {
+        Word(key, 1 + Random(maxKey));
+        written += fprintf(stdout, "\n[%s %lu]\n", key, iSect);
+
+        /* Number the keys so that they're unique within the section. */
+        for (iEntry = 0; iEntry < perSect && written < target; iEntry++)
+        {
+            Word(key, 1 + Random(maxKey));
+            Word(val, Random(maxVal + 1));
+            written += fprintf(stdout, "%s%lu=%s\n", key, iEntry, val);
+        }
+    }
+
+    return ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
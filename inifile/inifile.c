@@ -34,6 +34,10 @@
 #include <string.h>
 #include "inifile.h"
 
+#ifdef INI_STATS
+#include <time.h>
+#endif
+
 /*
  * Maintainer's Notes
  * ==================
@@ -56,8 +60,40 @@
  *
  * If the double-indirected pointers don't make sense, read the note in
  * INI_Write() for an explaination. It's not as tricky as it seems.
+ *
+ * The STAT_*() macros keep the counters in INIFile::stats up to date. Unless
+ * INI_STATS is defined they expand to nothing, so don't put anything with
+ * side effects in their arguments.
  */
 
+#ifdef INI_STATS
+
+static double Now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+#define STAT_ADD(ini, field, n)     ((ini)->stats.field += (n))
+#define STAT_ALLOC(ini, n)          ((ini)->stats.loadAllocs++, (ini)->stats.loadAllocBytes += (n))
+#define STAT_START(t)               ((t) = Now())
+#define STAT_STOP(ini, field, t)    ((ini)->stats.field += Now() - (t))
+
+#else
+
+#define STAT_ADD(ini, field, n)     ((void) (ini))
+#define STAT_ALLOC(ini, n)          ((void) (ini))
+#define STAT_START(t)               ((void) 0)
+#define STAT_STOP(ini, field, t)    ((void) 0)
+
+#endif
+
 static int MarkEnd(char* p, char breaker)
 {
     while (*p != breaker && *p != '\n')
@@ -98,9 +134,133 @@ static char* BreakLine(char* line)
     return val;
 }
 
+static INISection* NewSection(INIFile* ini, const char* name, long offset)
+{
+    INISection* pSect;
+
+    pSect = (INISection*) malloc(sizeof(INISection) + strlen(name) + 1);
+    if (pSect == NULL)
+        return NULL;
+    STAT_ALLOC(ini, sizeof(INISection) + strlen(name) + 1);
+    strcpy(pSect->name, name);
+    pSect->pNext  = NULL;
+    pSect->pHead   = NULL;
+    pSect->offset  = offset;
+    pSect->ppIndex = NULL;
+    pSect->nIndex  = 0;
+    pSect->cIndex  = 0;
+    return pSect;
+}
+
+static INIEntry* NewEntry(INIFile* ini, char* line)
+{
+    INIEntry* pEntry;
+    char*     val;
+
+    /* Break the line we've read into a value and a key. It does this in the
+       buffer, and the key is at the start. */
+    val = BreakLine(line);
+    /* Badly formed pair? */
+    if (val == NULL)
+        return NULL;
+
+    /* Set up the new entry. */
+    pEntry = (INIEntry*) malloc(sizeof(INIEntry) + strlen(line) + 1);
+    if (pEntry == NULL)
+        return NULL;
+    STAT_ALLOC(ini, sizeof(INIEntry) + strlen(line) + 1);
+    strcpy(pEntry->key, line);
+    pEntry->pNext = NULL;
+
+    /* Now load the value. Can't use strdup() for portability. */
+    pEntry->val = malloc(strlen(val) + 1);
+    if (pEntry->val == NULL)
+    {
+        free(pEntry);
+        return NULL;
+    }
+    STAT_ALLOC(ini, strlen(val) + 1);
+    strcpy(pEntry->val, val);
+
+    return pEntry;
+}
+
+/*
+ * Parses the entries of a section that was skipped over by INI_LoadLazy(). It
+ * reads from just after the section's header up to the next one, following
+ * the same rules as INI_Load(). Once every section has been loaded, there's
+ * no need to keep the file open any longer.
+ */
+static int LoadSection(INIFile* ini, INISection* pSect)
+{
+    INIEntry** ppEntry;
+    char       buf[4096];
+    char*      pch;
+    int        ok;
+
+    if (pSect->offset == -1)
+        return 1;
+
+    ok = fseek(ini->fp, pSect->offset, SEEK_SET) == 0;
+    STAT_ADD(ini, lazyLoads, 1);
+
+    /* Never try again, even if this fails. */
+    pSect->offset = -1;
+
+    ppEntry = &pSect->pHead;
+    while (ok && fgets(buf, sizeof(buf), ini->fp) != NULL)
+    {
+        STAT_ADD(ini, loadBytes, strlen(buf));
+        pch = buf;
+
+        /* Skip whitespace. */
+        while (*pch == ' ' || *pch == '\t' || *pch == '\n')
+            pch++;
+
+        if (*pch == '[')
+        {
+            /* Another section header ends this section. */
+            if (MarkEnd(pch + 1, ']'))
+                break;
+        }
+        else if (*pch != ';' && *pch != '\0')
+        {
+            *ppEntry = NewEntry(ini, pch);
+            if (*ppEntry == NULL)
+                ok = 0;
+            else
+                ppEntry = &(*ppEntry)->pNext;
+        }
+    }
+
+    if (!ok)
+    {
+        perror("INI_LoadLazy");
+        ini->broken = 1;
+    }
+
+    if (--ini->nLazy == 0)
+    {
+        fclose(ini->fp);
+        ini->fp = NULL;
+    }
+
+    return ok;
+}
+
+/* Returns 0 if any section, this time or before, couldn't be loaded. */
+static int LoadAllSections(INIFile* ini)
+{
+    INISection* pSect;
+
+    for (pSect = ini->pHead; pSect != NULL && ini->nLazy > 0; pSect = pSect->pNext)
+        LoadSection(ini, pSect);
+    return !ini->broken;
+}
+
 /********************************************* Loading, Saving and Freeing **/
 
-INIFile* INI_Load(const char* path)
+static INIFile* Load(const char* path, int lazy)
 {
     FILE*        fp;
 
@@ -110,7 +270,9 @@ INIFile* INI_Load(const char* path)
 
     char         buf[4096];
     char*        pch;
-    char*        val;
+#ifdef INI_STATS
+    double       started;
+#endif
 
     assert(path != NULL);
     assert(strlen(path) > 0);
@@ -120,6 +282,8 @@ INIFile* INI_Load(const char* path)
      * handling, so it's ok. I'm not utterly happy with this code anyway.
      */
 
+    STAT_START(started);
+
     ini = NULL;
     fp = fopen(path, "rt");
     if (fp == NULL)
@@ -129,13 +293,19 @@ INIFile* INI_Load(const char* path)
     if (ini == NULL)
         goto CATASTROPHE;
 
+    memset(&ini->stats, 0, sizeof(INIStats));
+    STAT_ALLOC(ini, sizeof(INIFile) + strlen(path) + 1);
     strcpy(ini->path, path);
+    ini->fp    = NULL;
+    ini->nLazy = 0;
+    ini->broken = 0;
     ppSect  = &ini->pHead;
     *ppSect = NULL;
     ppEntry = NULL;
 
     while (fgets(buf, sizeof(buf), fp) != NULL)
     {
+        STAT_ADD(ini, loadBytes, strlen(buf));
         pch = buf;
 
         /* Skip whitespace. */
@@ -160,18 +330,25 @@ INIFile* INI_Load(const char* path)
             /* Search for the end. */
             if (MarkEnd(pch, ']'))
             {
-                /* Set up the new section. */
-                *ppSect = (INISection*) malloc(sizeof(INISection) + strlen(pch) + 1);
+                /* Set up the new section. When loading lazily, remember
+                   where its entries start and skip over them for now. */
+                *ppSect = NewSection(ini, pch, lazy ? ftell(fp) : -1);
                 if (*ppSect == NULL)
                     goto CATASTROPHE;
-                strcpy((*ppSect)->name, pch);
 
                 /* Set up for the next entry. */
-                ppEntry = &(*ppSect)->pHead;
+                if (lazy)
+                {
+                    ini->nLazy++;
+                    ppEntry = NULL;
+                }
+                else
+                {
+                    ppEntry = &(*ppSect)->pHead;
+                }
 
                 /* Set up for the next section. */
                 ppSect  = &(*ppSect)->pNext;
-                *ppSect = NULL;
             }
         }
         else if (ppEntry != NULL && *pch != ';' && *pch != '\0')
@@ -184,41 +361,26 @@ INIFile* INI_Load(const char* path)
              * pairs before the first section header.
              */
 
-            /* Break the line we've read into a value and a key. It does this
-               in the buffer, and the key is at the start. */
-            val = BreakLine(pch);
-            /* Badly formed pair? */
-            if (val == NULL)
-                goto CATASTROPHE;
-
-            /* Set up the new entry. */
-            *ppEntry = (INIEntry*) malloc(sizeof(INIEntry) + strlen(pch) + 1);
+            *ppEntry = NewEntry(ini, pch);
             if (*ppEntry == NULL)
                 goto CATASTROPHE;
-            strcpy((*ppEntry)->key, pch);
-
-            /* Now load the value. Can't use strdup() for portability. */
-            (*ppEntry)->val = malloc(strlen(val) + 1);
-            if ((*ppEntry)->val == NULL)
-            {
-                free(*ppEntry);
-                *ppEntry = NULL;
-                goto CATASTROPHE;
-            }
-            strcpy((*ppEntry)->val, val);
 
             /* Set up for the next entry. */
-            ppEntry  = &(*ppEntry)->pNext;
-            *ppEntry = NULL;
+            ppEntry = &(*ppEntry)->pNext;
         }
     }
 
-    fclose(fp);
+    /* Hang onto the file until every section has been loaded. */
+    if (ini->nLazy > 0)
+        ini->fp = fp;
+    else
+        fclose(fp);
+    STAT_STOP(ini, loadTime, started);
     return ini;
 
     /* The error handler. */
 CATASTROPHE:
-    perror("INI_Load");
+    perror(lazy ? "INI_LoadLazy" : "INI_Load");
     if (ini != NULL)
         INI_Free(ini);
     if (fp != NULL)
@@ -226,15 +388,41 @@ CATASTROPHE:
     return NULL;
 }
 
+INIFile* INI_Load(const char* path)
+{
+    return Load(path, 0);
+}
+
+INIFile* INI_LoadLazy(const char* path)
+{
+    return Load(path, 1);
+}
+
 void INI_Save(INIFile* ini)
 {
     FILE*       fp;
 
     INISection* pSect;
     INIEntry*   pEntry;
+#ifdef INI_STATS
+    double      started;
+#endif
 
     assert(ini != NULL);
 
+    STAT_START(started);
+    STAT_ADD(ini, saves, 1);
+
+    /*
+     * Anything not loaded yet would be lost when the file's truncated, as
+     * would the rest of any section that couldn't be loaded.
+     */
+    if (!LoadAllSections(ini))
+    {
+        fprintf(stderr, "Won't save %s, as not all of it could be loaded.\n", ini->path);
+        return;
+    }
+
     fp = fopen(ini->path, "wt");
     if (fp == NULL)
     {
@@ -253,7 +441,9 @@ void INI_Save(INIFile* ini)
             fprintf(fp, "%s=%s\n", pEntry->key, pEntry->val);
     }
 
+    STAT_ADD(ini, savedBytes, (unsigned long) ftell(fp));
     fclose(fp);
+    STAT_STOP(ini, saveTime, started);
 }
 
 void INI_Free(INIFile* ini)
@@ -277,20 +467,216 @@ void INI_Free(INIFile* ini)
             free(pToFree);
         }
 
+        free(pSect->ppIndex);
         pToFree = pSect;
         pSect = pSect->pNext;
         free(pToFree);
     }
 
+    if (ini->fp != NULL)
+        fclose(ini->fp);
     free(ini);
 }
 
+/**************************************************************** Ordering **/
+
+/*
+ * Each section can have an index: an array of pointers to its entries sorted
+ * by key. It's only built the first time somebody asks for entries in order,
+ * and from then on it's kept up to date by INI_Write() and INI_DeleteEntry().
+ * The list stays in the order the entries were added, so saving's unaffected.
+ *
+ * Keys can turn up more than once in a file, and the first one in the list is
+ * the one that counts. The index is built with a stable sort and new entries
+ * go after any equal ones, so the first of a run of equal keys in the index
+ * is always the first in the list too.
+ *
+ * A plain sorted array means inserting is a memmove(), but it's only moving
+ * pointers, it's cache friendly, and a range is just a slice of it.
+ */
+
+static void FreeIndex(INISection* pSect)
+{
+    free(pSect->ppIndex);
+    pSect->ppIndex = NULL;
+    pSect->nIndex  = 0;
+    pSect->cIndex  = 0;
+}
+
+static void MergeSort(INIEntry** ppEntries, INIEntry** ppTemp, size_t n)
+{
+    size_t iLeft;
+    size_t iRight;
+    size_t iOut;
+    size_t mid;
+
+    if (n < 2)
+        return;
+
+    mid = n / 2;
+    MergeSort(ppEntries, ppTemp, mid);
+    MergeSort(ppEntries + mid, ppTemp, n - mid);
+
+    /* Taking from the left on ties keeps it stable. */
+    iLeft  = 0;
+    iRight = mid;
+    for (iOut = 0; iOut < n; iOut++)
+    {
+        if (iRight == n || (iLeft < mid && strcmp(ppEntries[iLeft]->key, ppEntries[iRight]->key) <= 0))
+            ppTemp[iOut] = ppEntries[iLeft++];
+        else
+            ppTemp[iOut] = ppEntries[iRight++];
+    }
+    memcpy(ppEntries, ppTemp, n * sizeof(INIEntry*));
+}
+
+static int BuildIndex(INIFile* ini, INISection* pSect)
+{
+    INIEntry*  pEntry;
+    INIEntry** ppTemp;
+    size_t     n;
+
+    if (pSect->ppIndex != NULL)
+        return 1;
+
+    LoadSection(ini, pSect);
+
+    n = 0;
+    for (pEntry = pSect->pHead; pEntry != NULL; pEntry = pEntry->pNext)
+        n++;
+
+    /* Leave a bit of room for growth. */
+    pSect->ppIndex = (INIEntry**) malloc((n + 8) * sizeof(INIEntry*));
+    ppTemp = (INIEntry**) malloc((n + 1) * sizeof(INIEntry*));
+    if (pSect->ppIndex == NULL || ppTemp == NULL)
+    {
+        free(ppTemp);
+        FreeIndex(pSect);
+        return 0;
+    }
+    pSect->cIndex = n + 8;
+
+    n = 0;
+    for (pEntry = pSect->pHead; pEntry != NULL; pEntry = pEntry->pNext)
+        pSect->ppIndex[n++] = pEntry;
+    pSect->nIndex = n;
+
+    MergeSort(pSect->ppIndex, ppTemp, n);
+    free(ppTemp);
+    return 1;
+}
+
+/* Finds the first entry whose key isn't less than the given one. If pSteps
+   isn't NULL, the number of steps taken is added to it. */
+static size_t LowerBound(INISection* pSect, const char* key, unsigned long* pSteps)
+{
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    lo = 0;
+    hi = pSect->nIndex;
+    while (lo < hi)
+    {
+        if (pSteps != NULL)
+            (*pSteps)++;
+        mid = lo + (hi - lo) / 2;
+        if (strcmp(pSect->ppIndex[mid]->key, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Finds the first entry whose key is greater than the given one. If len's
+   non-zero, only that many characters of the key are compared. */
+static size_t UpperBound(INISection* pSect, const char* key, size_t len)
+{
+    size_t lo;
+    size_t hi;
+    size_t mid;
+    int    cmp;
+
+    lo = 0;
+    hi = pSect->nIndex;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (len > 0)
+            cmp = strncmp(pSect->ppIndex[mid]->key, key, len);
+        else
+            cmp = strcmp(pSect->ppIndex[mid]->key, key);
+        if (cmp <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static INIEntry* FindIndexed(INISection* pSect, const char* key, unsigned long* pSteps)
+{
+    size_t i;
+
+    i = LowerBound(pSect, key, pSteps);
+    if (i < pSect->nIndex && strcmp(pSect->ppIndex[i]->key, key) == 0)
+        return pSect->ppIndex[i];
+    return NULL;
+}
+
+static void IndexInsert(INISection* pSect, INIEntry* pEntry)
+{
+    INIEntry** ppNew;
+    size_t     i;
+
+    if (pSect->ppIndex == NULL)
+        return;
+
+    if (pSect->nIndex == pSect->cIndex)
+    {
+        ppNew = (INIEntry**) realloc(pSect->ppIndex, pSect->cIndex * 2 * sizeof(INIEntry*));
+        if (ppNew == NULL)
+        {
+            /* Give up on it; it'll be rebuilt when it's next needed. */
+            FreeIndex(pSect);
+            return;
+        }
+        pSect->ppIndex = ppNew;
+        pSect->cIndex *= 2;
+    }
+
+    i = UpperBound(pSect, pEntry->key, 0);
+    memmove(pSect->ppIndex + i + 1, pSect->ppIndex + i, (pSect->nIndex - i) * sizeof(INIEntry*));
+    pSect->ppIndex[i] = pEntry;
+    pSect->nIndex++;
+}
+
+static void IndexRemove(INISection* pSect, INIEntry* pEntry)
+{
+    size_t i;
+
+    if (pSect->ppIndex == NULL)
+        return;
+
+    for (i = LowerBound(pSect, pEntry->key, NULL); i < pSect->nIndex; i++)
+    {
+        if (pSect->ppIndex[i] == pEntry)
+        {
+            pSect->nIndex--;
+            memmove(pSect->ppIndex + i, pSect->ppIndex + i + 1, (pSect->nIndex - i) * sizeof(INIEntry*));
+            break;
+        }
+    }
+}
+
 /*************************************************** Querying and Updating **/
 
 const char* INI_Read(INIFile* ini, const char* section, const char* key)
 {
-    INISection* pSect;
-    INIEntry*   pEntry;
+    INISection*   pSect;
+    INIEntry*     pEntry;
+    unsigned long nSteps;
 
     assert(ini     != NULL);
     assert(section != NULL);
@@ -299,13 +685,29 @@ const char* INI_Read(INIFile* ini, const char* section, const char* key)
     assert(strlen(section) > 0);
     assert(strlen(key)     > 0);
 
+    STAT_ADD(ini, lookups, 1);
+
     for (pSect = ini->pHead; pSect != NULL; pSect = pSect->pNext)
     {
+        STAT_ADD(ini, chainSteps, 1);
         if (strcmp(pSect->name, section) == 0)
         {
+            if (pSect->ppIndex != NULL)
+            {
+                /* Only lookups count towards the steps. */
+                nSteps = 0;
+                pEntry = FindIndexed(pSect, key, &nSteps);
+                STAT_ADD(ini, chainSteps, nSteps);
+                return pEntry != NULL ? pEntry->val : NULL;
+            }
+
+            LoadSection(ini, pSect);
             for (pEntry = pSect->pHead; pEntry != NULL; pEntry = pEntry->pNext)
+            {
+                STAT_ADD(ini, chainSteps, 1);
                 if (strcmp(pEntry->key, key) == 0)
                     return pEntry->val;
+            }
 
             break;
         }
@@ -362,8 +764,16 @@ int INI_Write(INIFile* ini, const char* section, const char* key, const char* va
         if (*ppSect == NULL)
             return 0;
         strcpy((*ppSect)->name, section);
-        (*ppSect)->pNext = NULL;
-        (*ppSect)->pHead = NULL;
+        (*ppSect)->pNext   = NULL;
+        (*ppSect)->pHead   = NULL;
+        (*ppSect)->offset  = -1;
+        (*ppSect)->ppIndex = NULL;
+        (*ppSect)->nIndex  = 0;
+        (*ppSect)->cIndex  = 0;
+    }
+    else
+    {
+        LoadSection(ini, *ppSect);
     }
 
     /* Find the entry. */
@@ -387,11 +797,19 @@ int INI_Write(INIFile* ini, const char* section, const char* key, const char* va
     pNew = realloc((*ppEntry)->val, strlen(val) + 1);
     if (pNew == NULL)
     {
-        free(*ppEntry);
-        *ppEntry = NULL;
+        /* Only throw the entry away if it's the one we just made. */
+        if ((*ppEntry)->val == NULL)
+        {
+            free(*ppEntry);
+            *ppEntry = NULL;
+        }
         return 0;
     }
 
+    /* New entries have to be added to the index too. */
+    if ((*ppEntry)->val == NULL)
+        IndexInsert(*ppSect, *ppEntry);
+
     /* Put the new value in. */
     strcpy(pNew, val);
     (*ppEntry)->val = pNew;
@@ -417,6 +835,13 @@ void INI_DeleteSection(INIFile* ini, const char* section)
     {
         if (strcmp((*ppSect)->name, section) == 0)
         {
+            /* No need to load it just to throw it away. */
+            if ((*ppSect)->offset != -1 && --ini->nLazy == 0)
+            {
+                fclose(ini->fp);
+                ini->fp = NULL;
+            }
+
             /* Found it: delete the entries. */
             pEntry = (*ppSect)->pHead;
             while (pEntry != NULL)
@@ -429,6 +854,7 @@ void INI_DeleteSection(INIFile* ini, const char* section)
             }
 
             /* Rechain, and deallocate. */
+            free((*ppSect)->ppIndex);
             pToFree = *ppSect;
             *ppSect = (*ppSect)->pNext;
             free(pToFree);
@@ -455,11 +881,14 @@ void INI_DeleteEntry(INIFile* ini, const char* section, const char* key)
     {
         if (strcmp((*ppSect)->name, section) == 0)
         {
+            LoadSection(ini, *ppSect);
+
             /* Find the entry. */
             for (ppEntry = &(*ppSect)->pHead; *ppEntry != NULL; ppEntry = &(*ppEntry)->pNext)
             {
                 if (strcmp((*ppEntry)->key, key) == 0)
                 {
+                    IndexRemove(*ppSect, *ppEntry);
                     free((*ppEntry)->val);
 
                     /* Rechain and deallocate. */
@@ -473,6 +902,7 @@ void INI_DeleteEntry(INIFile* ini, const char* section, const char* key)
             /* If the section's empty, rechain and deallocate it. */
             if ((*ppSect)->pHead == NULL)
             {
+                free((*ppSect)->ppIndex);
                 pToFree = *ppSect;
                 *ppSect = (*ppSect)->pNext;
                 free(pToFree);
@@ -517,6 +947,10 @@ int INI_HasEntry(INIFile* ini, const char* section, const char* key)
     {
         if (strcmp(pSect->name, section) == 0)
         {
+            if (pSect->ppIndex != NULL)
+                return FindIndexed(pSect, key, NULL) != NULL;
+
+            LoadSection(ini, pSect);
             for (pEntry = pSect->pHead; pEntry != NULL; pEntry = pEntry->pNext)
                 if (strcmp(pEntry->key, key) == 0)
                     return 1;
@@ -557,6 +991,7 @@ size_t INI_EntryCount(INIFile* ini, const char* section)
     {
         if (strcmp(pSect->name, section) == 0)
         {
+            LoadSection(ini, pSect);
             n = 0;
             for (pEntry = pSect->pHead; pEntry != NULL; pEntry = pEntry->pNext)
                 n++;
@@ -602,6 +1037,7 @@ void INI_ListEntries(INIFile* ini, const char* section, char** list)
     {
         if (strcmp(pSect->name, section) == 0)
         {
+            LoadSection(ini, pSect);
             for (pEntry = pSect->pHead; pEntry != NULL; pEntry = pEntry->pNext)
             {
                 *list = pEntry->key;
@@ -611,6 +1047,69 @@ void INI_ListEntries(INIFile* ini, const char* section, char** list)
     }
 }
 
+size_t INI_ListRange(INIFile* ini, const char* section, const char* lo, const char* hi,
+                     char** list, size_t max)
+{
+    INISection* pSect;
+    size_t      iFirst;
+    size_t      iLast;
+    size_t      i;
+
+    assert(ini     != NULL);
+    assert(section != NULL);
+    assert(list != NULL || max == 0);
+
+    assert(strlen(section) > 0);
+
+    for (pSect = ini->pHead; pSect != NULL; pSect = pSect->pNext)
+        if (strcmp(pSect->name, section) == 0)
+            break;
+    if (pSect == NULL || !BuildIndex(ini, pSect))
+        return 0;
+
+    iFirst = lo == NULL ? 0 : LowerBound(pSect, lo, NULL);
+    iLast  = hi == NULL ? pSect->nIndex : LowerBound(pSect, hi, NULL);
+    if (iLast <= iFirst)
+        return 0;
+
+    for (i = 0; i < iLast - iFirst && i < max; i++)
+        list[i] = pSect->ppIndex[iFirst + i]->key;
+
+    return iLast - iFirst;
+}
+
+size_t INI_ListPrefix(INIFile* ini, const char* section, const char* prefix,
+                      char** list, size_t max)
+{
+    INISection* pSect;
+    size_t      iFirst;
+    size_t      iLast;
+    size_t      i;
+
+    assert(ini     != NULL);
+    assert(section != NULL);
+    assert(prefix  != NULL);
+    assert(list != NULL || max == 0);
+
+    assert(strlen(section) > 0);
+
+    for (pSect = ini->pHead; pSect != NULL; pSect = pSect->pNext)
+        if (strcmp(pSect->name, section) == 0)
+            break;
+    if (pSect == NULL || !BuildIndex(ini, pSect))
+        return 0;
+
+    /* Everything from the prefix itself up to the last key starting with
+       it. An empty prefix matches everything. */
+    iFirst = LowerBound(pSect, prefix, NULL);
+    iLast  = *prefix == '\0' ? pSect->nIndex : UpperBound(pSect, prefix, strlen(prefix));
+
+    for (i = 0; i < iLast - iFirst && i < max; i++)
+        list[i] = pSect->ppIndex[iFirst + i]->key;
+
+    return iLast - iFirst;
+}
+
 /************************************************************* Diagnostics **/
 
 void INI_Dump(INIFile* ini)
@@ -647,3 +1146,32 @@ void INI_Dump(INIFile* ini)
     free(sections);
 }
 
+void INI_GetStats(INIFile* ini, INIStats* stats)
+{
+    assert(ini   != NULL);
+    assert(stats != NULL);
+
+    memcpy(stats, &ini->stats, sizeof(INIStats));
+}
+
+void INI_DumpStats(INIFile* ini)
+{
+    const INIStats* pStats;
+
+    assert(ini != NULL);
+
+    pStats = &ini->stats;
+    printf("Stats for %s:\n\n", ini->path);
+#ifndef INI_STATS
+    puts("(not compiled with INI_STATS, so these are all zero)");
+#endif
+    printf("Load:   %lu bytes, %lu allocations (%lu bytes), %.6f secs\n",
+           pStats->loadBytes, pStats->loadAllocs, pStats->loadAllocBytes,
+           pStats->loadTime);
+    printf("Lazy:   %lu sections loaded on demand\n", pStats->lazyLoads);
+    printf("Lookup: %lu reads, %.2f nodes walked per read\n",
+           pStats->lookups,
+           pStats->lookups > 0 ? (double) pStats->chainSteps / pStats->lookups : 0.0);
+    printf("Save:   %lu saves, %lu bytes written, %.6f secs\n\n",
+           pStats->saves, pStats->savedBytes, pStats->saveTime);
+}
@@ -31,6 +31,7 @@
  */
 
 #include <stddef.h>
+#include <stdio.h>
 
 /*
  * File Format
@@ -92,15 +93,47 @@ typedef struct INISection
 {
     struct INISection* pNext;     /* Next sibling in the file.     */
     struct INIEntry*   pHead;     /* Header for its entry list.    */
+    long               offset;    /* Where its entries start in    */
+                                  /* the file if not loaded yet,   */
+                                  /* else -1.                      */
+    struct INIEntry**  ppIndex;   /* Entries sorted by key, or     */
+                                  /* NULL if not needed yet.       */
+    size_t             nIndex;    /* Entries in the index.         */
+    size_t             cIndex;    /* Capacity of the index.        */
     char               name[1];   /* Name of this section.         */
 } INISection;
 
+/**
+ * Performance counters for a file.
+ *
+ * @note These are only kept if the library was compiled with INI_STATS
+ *       defined. Otherwise they're always zero, and cost nothing.
+ */
+typedef struct
+{
+    unsigned long loadBytes;      /* Bytes read by INI_Load().     */
+    unsigned long loadAllocs;     /* Allocations made loading it.  */
+    unsigned long loadAllocBytes; /* Bytes allocated loading it.   */
+    double        loadTime;       /* Seconds spent loading it.     */
+    unsigned long lazyLoads;      /* Sections loaded on demand.    */
+    unsigned long lookups;        /* Calls to INI_Read().          */
+    unsigned long chainSteps;     /* Nodes INI_Read() walked.      */
+    unsigned long saves;          /* Calls to INI_Save().          */
+    unsigned long savedBytes;     /* Bytes written by INI_Save().  */
+    double        saveTime;       /* Seconds spent saving it.      */
+} INIStats;
+
 /**
  * Represents a file.
  */
 typedef struct
 {
     struct INISection* pHead;     /* Header for its section list.  */
+    FILE*              fp;        /* File, while it's being loaded */
+                                  /* lazily.                       */
+    size_t             nLazy;     /* Sections not loaded yet.      */
+    int                broken;    /* Set if one couldn't be.       */
+    INIStats           stats;     /* Performance counters.         */
     char               path[1];   /* Path of .ini file.            */
 } INIFile;
 
@@ -113,6 +146,27 @@ typedef struct
  */
 INIFile* INI_Load(const char* path);
 
+/**
+ * Loads an .ini file into memory lazily.
+ *
+ * Only the section headers are read in at first. The entries in a section
+ * aren't parsed until something needs them, such as INI_Read() or
+ * INI_HasEntry() on that section, so if you only use a handful of sections
+ * in a big file, you only pay for those.
+ *
+ * @param  path  Path to .ini file to load.
+ *
+ * @return Handle of .ini file, or NULL if could not be loaded.
+ *
+ * @note The file's kept open until every section's been loaded, and it
+ *       mustn't be changed by anybody else in the meantime.
+ * @note A badly formed key/value pair makes INI_Load() fail. Here it's only
+ *       noticed once the section's loaded, and the section is cut short.
+ * @note INI_Save() loads any sections that haven't been yet, and won't save
+ *       the file at all if any section was cut short, now or earlier.
+ */
+INIFile* INI_LoadLazy(const char* path);
+
 /**
  * Saves an .ini file.
  *
@@ -239,6 +293,46 @@ void INI_ListSections(INIFile* ini, char** list);
  */
 void INI_ListEntries(INIFile* ini, const char* section, char** list);
 
+/**
+ * Lists the keys in a section that fall within a range, in sorted order.
+ *
+ * @param  ini      Handle.
+ * @param  section  Section to list.
+ * @param  lo       Lowest key to include, or NULL to start at the first.
+ * @param  hi       Key to stop before, or NULL to go to the last.
+ * @param  list     Buffer of character pointers to hold list. May be NULL
+ *                  if max is zero.
+ * @param  max      Number of pointers list can hold.
+ *
+ * @return Number of keys in the range, which may be more than max.
+ *
+ * @note Keys are compared with strcmp(), so `B' comes before `a'.
+ * @note The first time a section's listed in order, it's given an index
+ *       that's kept up to date from then on, and that INI_Read() and
+ *       INI_HasEntry() use too. Returns zero if there's no memory for it.
+ * @note See INI_ListSections() for further details.
+ */
+size_t INI_ListRange(INIFile* ini, const char* section, const char* lo, const char* hi,
+                     char** list, size_t max);
+
+/**
+ * Lists the keys in a section that start with a given prefix, in sorted
+ * order.
+ *
+ * @param  ini      Handle.
+ * @param  section  Section to list.
+ * @param  prefix   Prefix the keys must have, e.g. `db.replica.'.
+ * @param  list     Buffer of character pointers to hold list. May be NULL
+ *                  if max is zero.
+ * @param  max      Number of pointers list can hold.
+ *
+ * @return Number of keys with that prefix, which may be more than max.
+ *
+ * @note See INI_ListRange() for further details.
+ */
+size_t INI_ListPrefix(INIFile* ini, const char* section, const char* prefix,
+                      char** list, size_t max);
+
 /**
  * Dumps the contents of the file to the screen.
  *
@@ -249,6 +343,23 @@ void INI_ListEntries(INIFile* ini, const char* section, char** list);
  */
 void INI_Dump(INIFile* ini);
 
+/**
+ * Fetches the performance counters of a file.
+ *
+ * @param  ini    Handle.
+ * @param  stats  Where to put them.
+ *
+ * @note Only useful if the library was compiled with INI_STATS defined.
+ */
+void INI_GetStats(INIFile* ini, INIStats* stats);
+
+/**
+ * Dumps the performance counters of a file to the screen.
+ *
+ * @param  ini  Handle.
+ */
+void INI_DumpStats(INIFile* ini);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,65 @@
+/*                                       vim:set ts=4 sw=4 noai sr sta et cin:
+ * Queries a directory of .ini files through an inistore index.
+ * This file is in the Public Domain.
+ *
+ * Usage: iniquery [-j threads] <dir> <index> <section> <key> <value>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inistore.h"
+
+int main(int argc, char** argv)
+{
+    INIStore*    store;
+    const char** list;
+    size_t       nFound;
+    size_t       iFound;
+    long         nLoaded;
+    int          nThreads;
+    int          iArg;
+
+    nThreads = 0;
+    iArg = 1;
+    if (argc > 2 && strcmp(argv[1], "-j") == 0)
+    {
+        nThreads = atoi(argv[2]);
+        iArg = 3;
+    }
+    if (argc - iArg != 5)
+    {
+        fprintf(stderr, "Usage: %s [-j threads] <dir> <index> <section> <key> <value>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    store = INIStore_Open(argv[iArg], argv[iArg + 1]);
+    if (store == NULL)
+    {
+        perror("iniquery");
+        return EXIT_FAILURE;
+    }
+
+    nLoaded = INIStore_Refresh(store, nThreads);
+    if (nLoaded < 0)
+    {
+        fprintf(stderr, "Could not refresh the index from %s.\n", argv[iArg]);
+        INIStore_Free(store);
+        return EXIT_FAILURE;
+    }
+    if (nLoaded > 0 && !INIStore_Save(store))
+        fprintf(stderr, "Could not save %s.\n", argv[iArg + 1]);
+
+    nFound = INIStore_Query(store, argv[iArg + 2], argv[iArg + 3], argv[iArg + 4], NULL, 0);
+    list = (const char**) malloc((nFound + 1) * sizeof(char*));
+    if (list != NULL)
+    {
+        INIStore_Query(store, argv[iArg + 2], argv[iArg + 3], argv[iArg + 4], list, nFound);
+        for (iFound = 0; iFound < nFound; iFound++)
+            puts(list[iFound]);
+        free(list);
+    }
+
+    INIStore_Free(store);
+    return nFound > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1046 @@
+/*                                       vim:set ts=4 sw=4 noai sr sta et cin:
+ * inistore.c
+ * by Keith Gaughan <kmgaughan@eircom.net>
+ *
+ * Answers queries over a whole directory of .ini files.
+ *
+ * Copyright (c) Keith Gaughan, 2004.
+ * All Rights Reserved.
+ *
+ * Permission is granted to anyone to use this software for any purpose on any
+ * computer system, and to alter it and redistribute it, subject to the
+ * following restrictions:
+ *
+ *  1. The author is not responsible for the consequences of use of this
+ *     software, no matter how awful, even if they arise from flaws in it.
+ *
+ *  2. The origin of this software must not be misrepresented, either by
+ *     explicit claim or by omission. Since few users ever read sources,
+ *     credits must appear in the documentation.
+ *
+ *  3. Altered versions must be plainly marked as such, and must not be
+ *     misrepresented as being the original software. Since few users ever
+ *     read sources, credits must appear in the documentation.
+ *
+ *  4. The author reserves the right to change the licencing details on any
+ *     future releases of this package.
+ *
+ *  5. This notice may not be removed or altered.
+ */
+
+#include <assert.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "inifile.h"
+#include "inistore.h"
+
+/*
+ * Maintainer's Notes
+ * ==================
+ *
+ * There are two hash tables in here: one mapping each (section, key, value)
+ * triple to a posting list of the files containing it, and one mapping file
+ * names to their slot in the file table. Both use chaining, because that's
+ * what everything else in this library does.
+ *
+ * A file's slot number is its identity in the posting lists. When a file
+ * changes or disappears, its number is stripped from every posting list in
+ * one pass, and only then are the slots of deleted files handed out again.
+ * Do it the other way around and new files lose their postings.
+ *
+ * The loading threads never touch the store. Each one flattens the files it
+ * loads into a private buffer, and the main thread merges those in once
+ * they've all finished, so there's no locking beyond handing out work.
+ */
+
+#define INDEX_MAGIC "INISTOR\2"
+
+typedef struct StoreFile
+{
+    char*     name;           /* Name, or NULL if the slot's free.  */
+    long long mtime;          /* Modification time when loaded, ns. */
+    long long size;           /* Size when loaded, or -1 if not yet.*/
+    long      nextByName;     /* Next slot in its name chain.       */
+    int       seen;           /* Seen during the current refresh.   */
+} StoreFile;
+
+typedef struct Posting
+{
+    struct Posting* pNext;    /* Next posting in its chain.         */
+    unsigned long   hash;     /* Hash of the triple.                */
+    size_t          nFiles;   /* Number of files holding it.        */
+    size_t          cFiles;   /* Capacity of the file list.         */
+    unsigned*       files;    /* Slots of the files holding it.     */
+    size_t          len;      /* Length of the triple, with NULs.   */
+    char            tuple[1]; /* `section\0key\0value\0'.           */
+} Posting;
+
+struct INIStore
+{
+    char*       dir;          /* Directory holding the .ini files.  */
+    char*       indexPath;    /* Path of the index file.            */
+
+    StoreFile*  files;        /* File table.                        */
+    size_t      nFiles;       /* Slots in use, including free ones. */
+    size_t      cFiles;       /* Capacity of the file table.        */
+    size_t      nFree;        /* Number of free slots.              */
+    long*       nameBuckets;  /* Heads of the name chains.          */
+    size_t      nNameBuckets; /* Number of name chains.             */
+
+    Posting**   buckets;      /* Heads of the posting chains.       */
+    size_t      nBuckets;     /* Number of posting chains.          */
+    size_t      nPostings;    /* Number of postings.                */
+};
+
+typedef struct Job
+{
+    unsigned    slot;         /* Slot of the file to load.          */
+    char*       path;         /* Full path of the file.             */
+    long long   mtime;        /* Modification time of the file, ns. */
+    long long   size;         /* Size of the file.                  */
+    char*       tuples;       /* Flattened triples, back to back.   */
+    size_t      nTuples;      /* Number of triples in tuples.       */
+    int         failed;       /* Set if it couldn't be loaded.      */
+} Job;
+
+typedef struct Workers
+{
+    pthread_mutex_t lock;     /* Guards iNext.                      */
+    Job*            jobs;     /* The work to be done.               */
+    size_t          nJobs;    /* Number of jobs.                    */
+    size_t          iNext;    /* Next job to hand out.              */
+} Workers;
+
+/******************************************************************* Utils **/
+
+/* FNV-1a. It's quick, and good enough for strings. */
+static unsigned long HashBytes(unsigned long h, const char* p, size_t n)
+{
+    while (n-- > 0)
+    {
+        h ^= (unsigned char) *p++;
+        h *= 16777619UL;
+        h &= 0xFFFFFFFFUL;
+    }
+    return h;
+}
+
+static unsigned long HashTriple(const char* section, const char* key, const char* val)
+{
+    unsigned long h;
+
+    h = HashBytes(2166136261UL, section, strlen(section) + 1);
+    h = HashBytes(h, key, strlen(key) + 1);
+    return HashBytes(h, val, strlen(val) + 1);
+}
+
+static int TupleEquals(const Posting* pPost, const char* section, const char* key, const char* val)
+{
+    const char* pch;
+
+    pch = pPost->tuple;
+    if (strcmp(pch, section) != 0)
+        return 0;
+    pch += strlen(pch) + 1;
+    if (strcmp(pch, key) != 0)
+        return 0;
+    pch += strlen(pch) + 1;
+    return strcmp(pch, val) == 0;
+}
+
+static char* CopyString(const char* s)
+{
+    char* pNew;
+
+    /* Can't use strdup() for portability. */
+    pNew = malloc(strlen(s) + 1);
+    if (pNew != NULL)
+        strcpy(pNew, s);
+    return pNew;
+}
+
+static char* JoinPath(const char* dir, const char* name)
+{
+    char* path;
+
+    path = malloc(strlen(dir) + strlen(name) + 2);
+    if (path != NULL)
+        sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+/************************************************************* File Table **/
+
+static long FindFile(INIStore* store, const char* name)
+{
+    long iFile;
+
+    if (store->nNameBuckets == 0)
+        return -1;
+
+    iFile = store->nameBuckets[HashBytes(2166136261UL, name, strlen(name)) % store->nNameBuckets];
+    for (; iFile != -1; iFile = store->files[iFile].nextByName)
+        if (strcmp(store->files[iFile].name, name) == 0)
+            break;
+    return iFile;
+}
+
+static int RehashFiles(INIStore* store, size_t nBuckets)
+{
+    long*  pNew;
+    size_t iFile;
+    size_t iBucket;
+
+    pNew = malloc(nBuckets * sizeof(long));
+    if (pNew == NULL)
+        return 0;
+    for (iBucket = 0; iBucket < nBuckets; iBucket++)
+        pNew[iBucket] = -1;
+
+    for (iFile = 0; iFile < store->nFiles; iFile++)
+    {
+        if (store->files[iFile].name == NULL)
+            continue;
+        iBucket = HashBytes(2166136261UL, store->files[iFile].name,
+                            strlen(store->files[iFile].name)) % nBuckets;
+        store->files[iFile].nextByName = pNew[iBucket];
+        pNew[iBucket] = (long) iFile;
+    }
+
+    free(store->nameBuckets);
+    store->nameBuckets  = pNew;
+    store->nNameBuckets = nBuckets;
+    return 1;
+}
+
+static long AppendSlot(INIStore* store)
+{
+    StoreFile* pNew;
+
+    if (store->nFiles == store->cFiles)
+    {
+        pNew = realloc(store->files, (store->cFiles * 2 + 16) * sizeof(StoreFile));
+        if (pNew == NULL)
+            return -1;
+        store->files  = pNew;
+        store->cFiles = store->cFiles * 2 + 16;
+    }
+
+    store->files[store->nFiles].name = NULL;
+    store->nFree++;
+    return (long) store->nFiles++;
+}
+
+static int LinkFile(INIStore* store, size_t iFile)
+{
+    size_t iBucket;
+
+    store->nFree--;
+
+    /* Rehashing picks up the new file too. */
+    if (store->nFiles > store->nNameBuckets)
+        return RehashFiles(store, store->nFiles * 2 + 15);
+
+    iBucket = HashBytes(2166136261UL, store->files[iFile].name,
+                        strlen(store->files[iFile].name)) % store->nNameBuckets;
+    store->files[iFile].nextByName = store->nameBuckets[iBucket];
+    store->nameBuckets[iBucket] = (long) iFile;
+    return 1;
+}
+
+static long AddFile(INIStore* store, char* name, long long mtime, long long size)
+{
+    long iFile;
+
+    /* Reuse a free slot if there is one. */
+    iFile = -1;
+    if (store->nFree > 0)
+    {
+        for (iFile = 0; (size_t) iFile < store->nFiles; iFile++)
+            if (store->files[iFile].name == NULL)
+                break;
+    }
+    if (iFile == -1 || (size_t) iFile == store->nFiles)
+    {
+        iFile = AppendSlot(store);
+        if (iFile == -1)
+            return -1;
+    }
+
+    store->files[iFile].name  = name;
+    store->files[iFile].mtime = mtime;
+    store->files[iFile].size  = size;
+    store->files[iFile].seen  = 1;
+    if (!LinkFile(store, (size_t) iFile))
+    {
+        store->files[iFile].name = NULL;
+        store->nFree++;
+        return -1;
+    }
+
+    return iFile;
+}
+
+static void DropFile(INIStore* store, size_t iDead)
+{
+    long* pLink;
+
+    pLink = &store->nameBuckets[HashBytes(2166136261UL, store->files[iDead].name,
+                                          strlen(store->files[iDead].name)) % store->nNameBuckets];
+    while (*pLink != (long) iDead)
+        pLink = &store->files[*pLink].nextByName;
+    *pLink = store->files[iDead].nextByName;
+
+    free(store->files[iDead].name);
+    store->files[iDead].name = NULL;
+    store->nFree++;
+}
+
+/*************************************************************** Postings **/
+
+static int RehashPostings(INIStore* store, size_t nBuckets)
+{
+    Posting** pNew;
+    Posting*  pPost;
+    Posting*  pNext;
+    size_t    iBucket;
+
+    pNew = calloc(nBuckets, sizeof(Posting*));
+    if (pNew == NULL)
+        return 0;
+
+    for (iBucket = 0; iBucket < store->nBuckets; iBucket++)
+    {
+        for (pPost = store->buckets[iBucket]; pPost != NULL; pPost = pNext)
+        {
+            pNext = pPost->pNext;
+            pPost->pNext = pNew[pPost->hash % nBuckets];
+            pNew[pPost->hash % nBuckets] = pPost;
+        }
+    }
+
+    free(store->buckets);
+    store->buckets  = pNew;
+    store->nBuckets = nBuckets;
+    return 1;
+}
+
+static Posting* FindPosting(INIStore* store, unsigned long hash,
+                            const char* section, const char* key, const char* val)
+{
+    Posting* pPost;
+
+    if (store->nBuckets == 0)
+        return NULL;
+
+    for (pPost = store->buckets[hash % store->nBuckets]; pPost != NULL; pPost = pPost->pNext)
+        if (pPost->hash == hash && TupleEquals(pPost, section, key, val))
+            break;
+    return pPost;
+}
+
+static Posting* NewPosting(INIStore* store, unsigned long hash, const char* tuple, size_t len)
+{
+    Posting* pPost;
+
+    if (store->nPostings >= store->nBuckets * 2)
+        if (!RehashPostings(store, store->nBuckets * 2 + 1023))
+            return NULL;
+
+    pPost = (Posting*) malloc(sizeof(Posting) + len);
+    if (pPost == NULL)
+        return NULL;
+    memcpy(pPost->tuple, tuple, len);
+    pPost->len    = len;
+    pPost->hash   = hash;
+    pPost->nFiles = 0;
+    pPost->cFiles = 0;
+    pPost->files  = NULL;
+
+    pPost->pNext = store->buckets[hash % store->nBuckets];
+    store->buckets[hash % store->nBuckets] = pPost;
+    store->nPostings++;
+    return pPost;
+}
+
+static int AddToPosting(Posting* pPost, unsigned slot)
+{
+    unsigned* pNew;
+
+    if (pPost->nFiles == pPost->cFiles)
+    {
+        pNew = realloc(pPost->files, (pPost->cFiles * 2 + 4) * sizeof(unsigned));
+        if (pNew == NULL)
+            return 0;
+        pPost->files  = pNew;
+        pPost->cFiles = pPost->cFiles * 2 + 4;
+    }
+    pPost->files[pPost->nFiles++] = slot;
+    return 1;
+}
+
+/*
+ * Strips the given slots from every posting list, and deletes any postings
+ * left empty. It's a single pass over the whole index no matter how many
+ * files changed.
+ */
+static void StripSlots(INIStore* store, const char* stale)
+{
+    Posting** ppPost;
+    Posting*  pToFree;
+    size_t    iBucket;
+    size_t    iIn;
+    size_t    iOut;
+
+    for (iBucket = 0; iBucket < store->nBuckets; iBucket++)
+    {
+        ppPost = &store->buckets[iBucket];
+        while (*ppPost != NULL)
+        {
+            iOut = 0;
+            for (iIn = 0; iIn < (*ppPost)->nFiles; iIn++)
+                if (!stale[(*ppPost)->files[iIn]])
+                    (*ppPost)->files[iOut++] = (*ppPost)->files[iIn];
+            (*ppPost)->nFiles = iOut;
+
+            if (iOut == 0)
+            {
+                /* Rechain and deallocate. */
+                pToFree = *ppPost;
+                *ppPost = (*ppPost)->pNext;
+                free(pToFree->files);
+                free(pToFree);
+                store->nPostings--;
+            }
+            else
+            {
+                ppPost = &(*ppPost)->pNext;
+            }
+        }
+    }
+}
+
+/**************************************************************** Loading **/
+
+/* Flattens a loaded file into a run of back to back triples. */
+static void Flatten(INIFile* ini, Job* pJob)
+{
+    INISection* pSect;
+    INIEntry*   pEntry;
+    size_t      nBytes;
+    char*       pch;
+
+    nBytes = 0;
+    pJob->nTuples = 0;
+    for (pSect = ini->pHead; pSect != NULL; pSect = pSect->pNext)
+    {
+        for (pEntry = pSect->pHead; pEntry != NULL; pEntry = pEntry->pNext)
+        {
+            nBytes += strlen(pSect->name) + strlen(pEntry->key) + strlen(pEntry->val) + 3;
+            pJob->nTuples++;
+        }
+    }
+
+    pJob->tuples = malloc(nBytes + 1);
+    if (pJob->tuples == NULL)
+    {
+        pJob->nTuples = 0;
+        pJob->failed  = 1;
+        return;
+    }
+
+    pch = pJob->tuples;
+    for (pSect = ini->pHead; pSect != NULL; pSect = pSect->pNext)
+    {
+        for (pEntry = pSect->pHead; pEntry != NULL; pEntry = pEntry->pNext)
+        {
+            strcpy(pch, pSect->name);
+            pch += strlen(pch) + 1;
+            strcpy(pch, pEntry->key);
+            pch += strlen(pch) + 1;
+            strcpy(pch, pEntry->val);
+            pch += strlen(pch) + 1;
+        }
+    }
+}
+
+static void* Worker(void* arg)
+{
+    Workers* pWork;
+    INIFile* ini;
+    size_t   iJob;
+
+    pWork = (Workers*) arg;
+    for (;;)
+    {
+        pthread_mutex_lock(&pWork->lock);
+        iJob = pWork->iNext++;
+        pthread_mutex_unlock(&pWork->lock);
+        if (iJob >= pWork->nJobs)
+            break;
+
+        /* A file that won't load contributes nothing for now. */
+        ini = INI_Load(pWork->jobs[iJob].path);
+        if (ini == NULL)
+        {
+            pWork->jobs[iJob].failed = 1;
+            continue;
+        }
+        Flatten(ini, &pWork->jobs[iJob]);
+        INI_Free(ini);
+    }
+
+    return NULL;
+}
+
+static int RunJobs(Job* jobs, size_t nJobs, int nThreads)
+{
+    Workers    work;
+    pthread_t* threads;
+    int        iThread;
+    int        nStarted;
+
+    if (nThreads <= 0)
+    {
+        nThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (nThreads <= 0)
+            nThreads = 1;
+    }
+    if ((size_t) nThreads > nJobs)
+        nThreads = (int) nJobs;
+
+    work.jobs  = jobs;
+    work.nJobs = nJobs;
+    work.iNext = 0;
+    if (pthread_mutex_init(&work.lock, NULL) != 0)
+        return 0;
+
+    threads = malloc(nThreads * sizeof(pthread_t));
+    if (threads == NULL)
+    {
+        pthread_mutex_destroy(&work.lock);
+        return 0;
+    }
+
+    /* If we can't start as many threads as we'd like, we make do. */
+    nStarted = 0;
+    for (iThread = 0; iThread < nThreads; iThread++)
+        if (pthread_create(&threads[nStarted], NULL, Worker, &work) == 0)
+            nStarted++;
+    if (nStarted == 0)
+        Worker(&work);
+    for (iThread = 0; iThread < nStarted; iThread++)
+        pthread_join(threads[iThread], NULL);
+
+    free(threads);
+    pthread_mutex_destroy(&work.lock);
+    return 1;
+}
+
+static int MergeJob(INIStore* store, const Job* pJob)
+{
+    Posting*      pPost;
+    const char*   section;
+    const char*   key;
+    const char*   val;
+    const char*   pch;
+    unsigned long hash;
+    size_t        iTuple;
+
+    pch = pJob->tuples;
+    for (iTuple = 0; iTuple < pJob->nTuples; iTuple++)
+    {
+        section = pch;
+        key     = section + strlen(section) + 1;
+        val     = key + strlen(key) + 1;
+        pch     = val + strlen(val) + 1;
+
+        hash  = HashTriple(section, key, val);
+        pPost = FindPosting(store, hash, section, key, val);
+        if (pPost == NULL)
+        {
+            pPost = NewPosting(store, hash, section, (size_t) (pch - section));
+            if (pPost == NULL)
+                return 0;
+        }
+
+        /* Duplicate keys in a file mean the slot may already be there. */
+        if (pPost->nFiles == 0 || pPost->files[pPost->nFiles - 1] != pJob->slot)
+            if (!AddToPosting(pPost, pJob->slot))
+                return 0;
+    }
+
+    return 1;
+}
+
+/************************************************************ Persistence **/
+
+static int ReadBytes(FILE* fp, void* buf, size_t n)
+{
+    return fread(buf, 1, n, fp) == n;
+}
+
+static int ReadIndex(INIStore* store)
+{
+    FILE*         fp;
+    char          magic[sizeof(INDEX_MAGIC) - 1];
+    unsigned      n;
+    unsigned      iItem;
+    unsigned      len;
+    unsigned      nRefs;
+    unsigned      iRef;
+    long long     stamp[2];
+    long          iSlot;
+    char*         name;
+    char*         tuple;
+    const char*   key;
+    const char*   val;
+    Posting*      pPost;
+
+    fp = fopen(store->indexPath, "rb");
+    if (fp == NULL)
+        return 0;
+
+    tuple = NULL;
+    if (!ReadBytes(fp, magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0)
+        goto CATASTROPHE;
+
+    /* The file table. */
+    if (!ReadBytes(fp, &n, sizeof(n)))
+        goto CATASTROPHE;
+    for (iItem = 0; iItem < n; iItem++)
+    {
+        if (!ReadBytes(fp, stamp, sizeof(stamp)) || !ReadBytes(fp, &len, sizeof(len)))
+            goto CATASTROPHE;
+
+        /* Free slots are kept so the posting lists still line up. */
+        iSlot = AppendSlot(store);
+        if (iSlot == -1)
+            goto CATASTROPHE;
+        store->files[iSlot].mtime = stamp[0];
+        store->files[iSlot].size  = stamp[1];
+        if (len == 0)
+            continue;
+
+        name = malloc(len + 1);
+        if (name == NULL)
+            goto CATASTROPHE;
+        if (!ReadBytes(fp, name, len))
+        {
+            free(name);
+            goto CATASTROPHE;
+        }
+        name[len] = '\0';
+
+        if (memchr(name, '\0', len) != NULL || FindFile(store, name) != -1)
+        {
+            free(name);
+            goto CATASTROPHE;
+        }
+        store->files[iSlot].name = name;
+        if (!LinkFile(store, (size_t) iSlot))
+            goto CATASTROPHE;
+    }
+
+    /* The postings. */
+    if (!ReadBytes(fp, &n, sizeof(n)))
+        goto CATASTROPHE;
+    for (iItem = 0; iItem < n; iItem++)
+    {
+        if (!ReadBytes(fp, &len, sizeof(len)) || len < 3)
+            goto CATASTROPHE;
+        tuple = malloc(len);
+        if (tuple == NULL || !ReadBytes(fp, tuple, len) || tuple[len - 1] != '\0')
+            goto CATASTROPHE;
+
+        key = tuple + strlen(tuple) + 1;
+        if (key >= tuple + len)
+            goto CATASTROPHE;
+        val = key + strlen(key) + 1;
+        if (val >= tuple + len || val + strlen(val) + 1 != tuple + len)
+            goto CATASTROPHE;
+
+        pPost = NewPosting(store, HashTriple(tuple, key, val), tuple, len);
+        free(tuple);
+        tuple = NULL;
+        if (pPost == NULL || !ReadBytes(fp, &nRefs, sizeof(nRefs)))
+            goto CATASTROPHE;
+
+        for (iRef = 0; iRef < nRefs; iRef++)
+        {
+            if (!ReadBytes(fp, &len, sizeof(len)) || len >= store->nFiles ||
+                store->files[len].name == NULL || !AddToPosting(pPost, len))
+                goto CATASTROPHE;
+        }
+    }
+
+    fclose(fp);
+    return 1;
+
+    /* The error handler. */
+CATASTROPHE:
+    free(tuple);
+    fclose(fp);
+    return 0;
+}
+
+static int WriteIndex(INIStore* store, FILE* fp)
+{
+    Posting*  pPost;
+    size_t    iBucket;
+    size_t    iFile;
+    unsigned  n;
+    long long stamp[2];
+
+    if (fwrite(INDEX_MAGIC, 1, sizeof(INDEX_MAGIC) - 1, fp) != sizeof(INDEX_MAGIC) - 1)
+        return 0;
+
+    n = (unsigned) store->nFiles;
+    fwrite(&n, sizeof(n), 1, fp);
+    for (iFile = 0; iFile < store->nFiles; iFile++)
+    {
+        stamp[0] = store->files[iFile].mtime;
+        stamp[1] = store->files[iFile].size;
+        n = store->files[iFile].name == NULL ? 0 : (unsigned) strlen(store->files[iFile].name);
+        fwrite(stamp, sizeof(stamp), 1, fp);
+        fwrite(&n, sizeof(n), 1, fp);
+        fwrite(store->files[iFile].name, 1, n, fp);
+    }
+
+    n = (unsigned) store->nPostings;
+    fwrite(&n, sizeof(n), 1, fp);
+    for (iBucket = 0; iBucket < store->nBuckets; iBucket++)
+    {
+        for (pPost = store->buckets[iBucket]; pPost != NULL; pPost = pPost->pNext)
+        {
+            n = (unsigned) pPost->len;
+            fwrite(&n, sizeof(n), 1, fp);
+            fwrite(pPost->tuple, 1, pPost->len, fp);
+            n = (unsigned) pPost->nFiles;
+            fwrite(&n, sizeof(n), 1, fp);
+            fwrite(pPost->files, sizeof(unsigned), pPost->nFiles, fp);
+        }
+    }
+
+    return !ferror(fp);
+}
+
+/* Empties the store, leaving it with no posting chains at all. */
+static void Clear(INIStore* store)
+{
+    Posting* pPost;
+    Posting* pNext;
+    size_t   iBucket;
+    size_t   iFile;
+
+    for (iBucket = 0; iBucket < store->nBuckets; iBucket++)
+    {
+        for (pPost = store->buckets[iBucket]; pPost != NULL; pPost = pNext)
+        {
+            pNext = pPost->pNext;
+            free(pPost->files);
+            free(pPost);
+        }
+    }
+    for (iFile = 0; iFile < store->nFiles; iFile++)
+        free(store->files[iFile].name);
+
+    free(store->buckets);
+    free(store->nameBuckets);
+    free(store->files);
+
+    store->buckets      = NULL;
+    store->nBuckets     = 0;
+    store->nPostings    = 0;
+    store->nameBuckets  = NULL;
+    store->nNameBuckets = 0;
+    store->files        = NULL;
+    store->nFiles       = 0;
+    store->cFiles       = 0;
+    store->nFree        = 0;
+}
+
+/************************************************************ Public Stuff **/
+
+INIStore* INIStore_Open(const char* dir, const char* indexPath)
+{
+    INIStore* store;
+
+    assert(dir       != NULL);
+    assert(indexPath != NULL);
+
+    store = (INIStore*) calloc(1, sizeof(INIStore));
+    if (store == NULL)
+        return NULL;
+
+    store->dir       = CopyString(dir);
+    store->indexPath = CopyString(indexPath);
+    if (store->dir == NULL || store->indexPath == NULL || !RehashPostings(store, 1023))
+    {
+        INIStore_Free(store);
+        return NULL;
+    }
+
+    /* A missing or mangled index just means starting from scratch. */
+    if (!ReadIndex(store))
+    {
+        Clear(store);
+        if (!RehashPostings(store, 1023))
+        {
+            INIStore_Free(store);
+            return NULL;
+        }
+    }
+
+    return store;
+}
+
+/*
+ * Seconds alone would miss a file rewritten at the same size within the
+ * second it was last loaded.
+ */
+static long long StampOf(const struct stat* sb)
+{
+    return (long long) sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+}
+
+long INIStore_Refresh(INIStore* store, int nThreads)
+{
+    DIR*           pDir;
+    struct dirent* pEnt;
+    struct stat    sb;
+    char*          path;
+    char*          stale;
+    Job*           jobs;
+    size_t         nJobs;
+    size_t         cJobs;
+    Job*           pNewJobs;
+    size_t         iFile;
+    size_t         iJob;
+    size_t         len;
+    long           iSlot;
+    int            anyStale;
+    int            ok;
+
+    assert(store != NULL);
+
+    pDir = opendir(store->dir);
+    if (pDir == NULL)
+        return -1;
+
+    jobs  = NULL;
+    nJobs = 0;
+    cJobs = 0;
+    ok    = 0;
+    stale = NULL;
+
+    for (iFile = 0; iFile < store->nFiles; iFile++)
+        store->files[iFile].seen = 0;
+
+    /*
+     * First pass: work out what's changed. New files are queued up with a
+     * slot of -1 because they can't be given one until the slots of any
+     * deleted files have been stripped from the index.
+     */
+    while ((pEnt = readdir(pDir)) != NULL)
+    {
+        len = strlen(pEnt->d_name);
+        if (len <= 4 || strcmp(pEnt->d_name + len - 4, ".ini") != 0)
+            continue;
+
+        path = JoinPath(store->dir, pEnt->d_name);
+        if (path == NULL)
+            goto CATASTROPHE;
+        if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode))
+        {
+            free(path);
+            continue;
+        }
+
+        iSlot = FindFile(store, pEnt->d_name);
+        if (iSlot != -1)
+        {
+            store->files[iSlot].seen = 1;
+            if (store->files[iSlot].mtime == StampOf(&sb) &&
+                store->files[iSlot].size  == (long long) sb.st_size)
+            {
+                free(path);
+                continue;
+            }
+        }
+
+        if (nJobs == cJobs)
+        {
+            pNewJobs = realloc(jobs, (cJobs * 2 + 64) * sizeof(Job));
+            if (pNewJobs == NULL)
+            {
+                free(path);
+                goto CATASTROPHE;
+            }
+            jobs  = pNewJobs;
+            cJobs = cJobs * 2 + 64;
+        }
+
+        jobs[nJobs].slot    = (unsigned) iSlot;
+        jobs[nJobs].path    = path;
+        jobs[nJobs].mtime   = StampOf(&sb);
+        jobs[nJobs].size    = (long long) sb.st_size;
+        jobs[nJobs].tuples  = NULL;
+        jobs[nJobs].nTuples = 0;
+        jobs[nJobs].failed  = 0;
+        nJobs++;
+    }
+
+    /* Second pass: strip changed and deleted files from the postings. */
+    anyStale = 0;
+    stale = calloc(store->nFiles + 1, 1);
+    if (stale == NULL)
+        goto CATASTROPHE;
+    for (iFile = 0; iFile < store->nFiles; iFile++)
+    {
+        if (store->files[iFile].name != NULL && !store->files[iFile].seen)
+            stale[iFile] = anyStale = 1;
+    }
+    for (iJob = 0; iJob < nJobs; iJob++)
+        if (jobs[iJob].slot != (unsigned) -1)
+            stale[jobs[iJob].slot] = anyStale = 1;
+    if (anyStale)
+        StripSlots(store, stale);
+    for (iFile = 0; iFile < store->nFiles; iFile++)
+        if (store->files[iFile].name != NULL && !store->files[iFile].seen)
+            DropFile(store, iFile);
+
+    /* Now the new files can be given slots. */
+    for (iJob = 0; iJob < nJobs; iJob++)
+    {
+        if (jobs[iJob].slot != (unsigned) -1)
+            continue;
+
+        path = CopyString(jobs[iJob].path + strlen(store->dir) + 1);
+        if (path == NULL)
+            goto CATASTROPHE;
+        iSlot = AddFile(store, path, -1, -1);
+        if (iSlot == -1)
+        {
+            free(path);
+            goto CATASTROPHE;
+        }
+        jobs[iJob].slot = (unsigned) iSlot;
+    }
+
+    /*
+     * Third pass: load everything in parallel, then merge it in. A file's
+     * only stamped as up to date once it's loaded and merged, so if anything
+     * fails before then, the next refresh loads it again.
+     */
+    if (nJobs > 0 && !RunJobs(jobs, nJobs, nThreads))
+        goto CATASTROPHE;
+    for (iJob = 0; iJob < nJobs; iJob++)
+    {
+        if (!MergeJob(store, &jobs[iJob]))
+            goto CATASTROPHE;
+        if (jobs[iJob].failed)
+            continue;
+        store->files[jobs[iJob].slot].mtime = jobs[iJob].mtime;
+        store->files[jobs[iJob].slot].size  = jobs[iJob].size;
+    }
+
+    ok = 1;
+
+    /* The error handler. */
+CATASTROPHE:
+    for (iJob = 0; iJob < nJobs; iJob++)
+    {
+        free(jobs[iJob].path);
+        free(jobs[iJob].tuples);
+    }
+    free(jobs);
+    free(stale);
+    closedir(pDir);
+    return ok ? (long) nJobs : -1;
+}
+
+int INIStore_Save(INIStore* store)
+{
+    FILE* fp;
+    char* tmpPath;
+    int   ok;
+
+    assert(store != NULL);
+
+    tmpPath = malloc(strlen(store->indexPath) + 5);
+    if (tmpPath == NULL)
+        return 0;
+    sprintf(tmpPath, "%s.tmp", store->indexPath);
+
+    fp = fopen(tmpPath, "wb");
+    if (fp == NULL)
+    {
+        free(tmpPath);
+        return 0;
+    }
+
+    ok = WriteIndex(store, fp);
+    if (fclose(fp) != 0)
+        ok = 0;
+    if (ok)
+        ok = rename(tmpPath, store->indexPath) == 0;
+    if (!ok)
+        remove(tmpPath);
+
+    free(tmpPath);
+    return ok;
+}
+
+void INIStore_Free(INIStore* store)
+{
+    assert(store != NULL);
+
+    Clear(store);
+    free(store->indexPath);
+    free(store->dir);
+    free(store);
+}
+
+size_t INIStore_Query(INIStore* store, const char* section, const char* key,
+                      const char* val, const char** list, size_t max)
+{
+    Posting* pPost;
+    size_t   iFile;
+
+    assert(store   != NULL);
+    assert(section != NULL);
+    assert(key     != NULL);
+    assert(val     != NULL);
+    assert(list != NULL || max == 0);
+
+    pPost = FindPosting(store, HashTriple(section, key, val), section, key, val);
+    if (pPost == NULL)
+        return 0;
+
+    for (iFile = 0; iFile < pPost->nFiles && iFile < max; iFile++)
+        list[iFile] = store->files[pPost->files[iFile]].name;
+
+    return pPost->nFiles;
+}
+
+size_t INIStore_FileCount(INIStore* store)
+{
+    size_t iFile;
+    size_t n;
+
+    assert(store != NULL);
+
+    n = 0;
+    for (iFile = 0; iFile < store->nFiles; iFile++)
+        if (store->files[iFile].name != NULL)
+            n++;
+
+    return n;
+}
@@ -0,0 +1,141 @@
+#ifndef INISTORE_H_INCLUDED
+#define INISTORE_H_INCLUDED
+/*                                       vim:set ts=4 sw=4 noai sr sta et cin:
+ * inistore.h
+ * by Keith Gaughan <kmgaughan@eircom.net>
+ *
+ * Answers queries over a whole directory of .ini files.
+ *
+ * Copyright (c) Keith Gaughan, 2004.
+ * All Rights Reserved.
+ *
+ * Permission is granted to anyone to use this software for any purpose on any
+ * computer system, and to alter it and redistribute it, subject to the
+ * following restrictions:
+ *
+ *  1. The author is not responsible for the consequences of use of this
+ *     software, no matter how awful, even if they arise from flaws in it.
+ *
+ *  2. The origin of this software must not be misrepresented, either by
+ *     explicit claim or by omission. Since few users ever read sources,
+ *     credits must appear in the documentation.
+ *
+ *  3. Altered versions must be plainly marked as such, and must not be
+ *     misrepresented as being the original software. Since few users ever
+ *     read sources, credits must appear in the documentation.
+ *
+ *  4. The author reserves the right to change the licencing details on any
+ *     future releases of this package.
+ *
+ *  5. This notice may not be removed or altered.
+ */
+
+#include <stddef.h>
+
+/*
+ * Overview
+ * ========
+ *
+ * If you've got thousands of .ini files (say, one per host) and you keep
+ * asking "which of them have `key=value' in `[section]'?", loading each one
+ * with INI_Load() every time gets old fast. A store keeps an inverted index
+ * from each (section, key, value) triple to the files containing it, so a
+ * query is a single hash lookup.
+ *
+ * The index is kept in a file of its own. INIStore_Refresh() compares the
+ * modification time and size of every .ini file in the directory against
+ * what was recorded and only reloads the ones that changed, spreading the
+ * work over as many threads as you ask for.
+ *
+ * The index file is written in the native byte order. It's a cache, so if
+ * it's bad or from a different machine, it's ignored and rebuilt.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Represents a store. Its innards are private.
+ */
+typedef struct INIStore INIStore;
+
+/**
+ * Opens a store.
+ *
+ * @param  dir        Directory containing the .ini files.
+ * @param  indexPath  Path of the index file. It needn't exist yet.
+ *
+ * @return Handle of store, or NULL if out of memory.
+ *
+ * @note This only reads the index; call INIStore_Refresh() to pick up any
+ *       changes made to the files since it was last saved.
+ */
+INIStore* INIStore_Open(const char* dir, const char* indexPath);
+
+/**
+ * Brings the index up to date with the directory.
+ *
+ * @param  store     Handle.
+ * @param  nThreads  Number of threads to load files with. Zero or less
+ *                   means one per online processor.
+ *
+ * @return Number of files (re)loaded, or -1 on error.
+ */
+long INIStore_Refresh(INIStore* store, int nThreads);
+
+/**
+ * Saves the index.
+ *
+ * @param  store  Handle.
+ *
+ * @return Non-zero if saved, else zero.
+ *
+ * @note The index is written to a temporary file and renamed into place, so
+ *       anybody else reading it won't see a half-written one.
+ */
+int INIStore_Save(INIStore* store);
+
+/**
+ * Frees a store.
+ *
+ * @param  store  Handle.
+ *
+ * @note This doesn't save it.
+ */
+void INIStore_Free(INIStore* store);
+
+/**
+ * Lists the files that have a given key set to a given value.
+ *
+ * @param  store    Handle.
+ * @param  section  Name of section.
+ * @param  key      Name of entry.
+ * @param  val      Value the entry must have.
+ * @param  list     Buffer of character pointers to hold the file names.
+ *                  May be NULL if max is zero.
+ * @param  max      Number of pointers list can hold.
+ *
+ * @return Number of matching files, which may be more than max.
+ *
+ * @note The names are relative to the store's directory.
+ * @note Don't mess with the strings! They're invalidated by
+ *       INIStore_Refresh() and INIStore_Free().
+ */
+size_t INIStore_Query(INIStore* store, const char* section, const char* key,
+                      const char* val, const char** list, size_t max);
+
+/**
+ * Counts the number of files in the store.
+ *
+ * @param  store  Handle.
+ *
+ * @return Number of files.
+ */
+size_t INIStore_FileCount(INIStore* store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INISTORE_H_INCLUDED */
@@ -10,113 +10,455 @@
  * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <time.h>
 #include <unistd.h>
+#include "sigdaemon.h"
+#include "sigindex.h"
+#include "sigpack.h"
+#include "sigrand.h"
 
 static const char* RCS_ID = "$Id: ksig.c,v 1.2 2003/12/15 18:52:43 kgaughan Exp $";
 
-#define SIGS_FILE  ".sigs"
-#define INDEX_FILE ".sigs.idx"
-#define FIXED_FILE ".fixedsig"
+/*
+ * This gets run every time a shell starts or a mail's composed, so the
+ * common case, where the index is up to date, is kept down to a handful of
+ * system calls: the index header's read and checked against a single fstat()
+ * of the signature file, the chosen entry's read straight out of the table,
+ * and the signature's read and written out in one go.
+ */
 
-int FileExists(const char* name)
+static void WriteAll(int fd, const char* buf, size_t n)
 {
-    struct stat sb;
-    return stat(name, &sb) == 0;
+    ssize_t nWritten;
+
+    while (n > 0)
+    {
+        nWritten = write(fd, buf, n);
+        if (nWritten <= 0)
+            break;
+        buf += nWritten;
+        n   -= (size_t) nWritten;
+    }
+}
+
+static void PrintFixedSig(void)
+{
+    char    buf[BUFSIZ];
+    ssize_t n;
+    int     fd;
+
+    fd = open(FIXED_FILE, O_RDONLY);
+    if (fd == -1)
+        return;
+    while ((n = read(fd, buf, sizeof buf)) > 0)
+        WriteAll(STDOUT_FILENO, buf, (size_t) n);
+    close(fd);
+}
+
+/*
+ * Opens the index if it's intact and, if `current' is set, was built from
+ * the signature file as it is now.
+ */
+static int OpenIndex(const char* idxPath, const struct stat* sbSigs, IndexHeader* pHdr, int current)
+{
+    int fdIdx;
+
+    fdIdx = open(idxPath, O_RDONLY);
+    if (fdIdx == -1)
+        return -1;
+    if (!SigIndex_ReadHeader(fdIdx, pHdr) || (current && !SigIndex_IsCurrent(pHdr, sbSigs)))
+    {
+        close(fdIdx);
+        return -1;
+    }
+    return fdIdx;
 }
 
-off_t GetFileSize(const char* name)
+/*
+ * When .sigs changes, every shell started before the index is rebuilt finds
+ * it out of date. Only the one that gets the lock rebuilds it; the rest make
+ * do with the old index, which is still intact, and every entry in it is
+ * bounds-checked, so the worst they'll print is a torn signature. Only if
+ * there's no usable index at all do they wait for the rebuild to finish.
+ */
+static int RefreshIndex(const char* sigsPath, const char* idxPath,
+                        const struct stat* sbSigs, IndexHeader* pHdr)
+{
+    int fdLock;
+    int fdIdx;
+
+    fdLock = SigIndex_Lock(idxPath, 0);
+    if (fdLock == -1 && errno == EAGAIN)
+    {
+        fdIdx = OpenIndex(idxPath, sbSigs, pHdr, 0);
+        if (fdIdx != -1)
+            return fdIdx;
+        fdLock = SigIndex_Lock(idxPath, 1);
+    }
+
+    /*
+     * It may have been rebuilt while we were waiting. If the lock couldn't
+     * be had at all, rebuild regardless: it's no less safe, only slower.
+     */
+    fdIdx = OpenIndex(idxPath, sbSigs, pHdr, 1);
+    if (fdIdx == -1 && SigIndex_Build(sigsPath, idxPath, 0) != -1)
+        fdIdx = OpenIndex(idxPath, sbSigs, pHdr, 1);
+    if (fdLock != -1)
+        close(fdLock);
+
+    /* The file may have changed again under us. Use whatever's there. */
+    if (fdIdx == -1)
+        fdIdx = OpenIndex(idxPath, sbSigs, pHdr, 0);
+    return fdIdx;
+}
+
+/*
+ * A signature file that's been packed with `ksig --compress' and then
+ * removed is read from its packed copy instead.
+ */
+static int IsPacked(const char* sigsPath, char* packPath)
 {
     struct stat sb;
 
-    if (stat(name, &sb) == 0)
-        return sb.st_size;
-    return 0;
+    return snprintf(packPath, PATH_MAX, "%s%s", sigsPath, PACK_SUFFIX) < PATH_MAX &&
+           stat(sigsPath, &sb) == -1 && errno == ENOENT &&
+           stat(packPath, &sb) == 0;
+}
+
+/*
+ * Checks a packed signature file. It carries its own index, so there's
+ * nothing that can be out of date.
+ */
+static int CheckPack(const char* packPath)
+{
+    PackHeader hdr;
+    int        fdPack;
+    int        ok;
+
+    fdPack = SigPack_Open(packPath, &hdr);
+    if (fdPack == -1)
+    {
+        fprintf(stderr, "%s: bad header\n", packPath);
+        return 0;
+    }
+    ok = SigPack_Verify(fdPack, &hdr);
+    close(fdPack);
+    if (!ok)
+    {
+        fprintf(stderr, "%s: bad table\n", packPath);
+        return 0;
+    }
+    printf("%s: %lu entries in %lu blocks, ok\n", packPath,
+           (unsigned long) hdr.nEntries, (unsigned long) hdr.nBlocks);
+    return 1;
 }
 
-time_t GetModificationTime(const char* name)
+/*
+ * Reads the whole index, checking its table against the checksum in the
+ * header and every entry against the signature file.
+ */
+static int CheckIndex(const char* sigsPath)
 {
+    char        idxPath[PATH_MAX];
+    char        packPath[PATH_MAX];
     struct stat sb;
+    IndexHeader hdr;
+    FILE*       fIdx;
+
+    if (IsPacked(sigsPath, packPath))
+        return CheckPack(packPath);
+    if (!SigIndex_PathOf(sigsPath, idxPath, sizeof idxPath) || stat(sigsPath, &sb) == -1)
+    {
+        perror(sigsPath);
+        return 0;
+    }
+    fIdx = fopen(idxPath, "rb");
+    if (fIdx == NULL)
+    {
+        perror(idxPath);
+        return 0;
+    }
+
+    if (!SigIndex_ReadHeader(fileno(fIdx), &hdr))
+    {
+        fprintf(stderr, "%s: bad header\n", idxPath);
+        fclose(fIdx);
+        return 0;
+    }
+    if (!SigIndex_IsCurrent(&hdr, &sb))
+        fprintf(stderr, "%s: out of date\n", idxPath);
+
+    if (!SigIndex_ReadTable(fIdx, &hdr, NULL))
+    {
+        fprintf(stderr, "%s: bad table\n", idxPath);
+        fclose(fIdx);
+        return 0;
+    }
+    fclose(fIdx);
 
-    if (stat(name, &sb) == 0)
-        return sb.st_mtime;
-    return 0;
+    printf("%s: %lu entries, ok\n", idxPath, (unsigned long) hdr.nEntries);
+    return SigIndex_IsCurrent(&hdr, &sb);
 }
 
-int main(void)
+/*
+ * Indexes the whole of the signature file from scratch, in case it's been
+ * edited in a way that appending to the existing index would miss.
+ */
+static int Reindex(const char* sigsPath)
 {
-    char          buf[BUFSIZ];
-    FILE*         f;
-    FILE*         fIdx;
-    unsigned long nEntries;
-    fpos_t        pos;
-    unsigned long offset;
-    char*         home;
+    char idxPath[PATH_MAX];
+    char packPath[PATH_MAX];
+    long nEntries;
+    int  fdLock;
 
-    /* Attempt to set the CWD to `~' */
-    home = getenv("HOME");
-    if (home != NULL)
-      chdir(home);
+    if (IsPacked(sigsPath, packPath))
+        return CheckPack(packPath);
+    if (!SigIndex_PathOf(sigsPath, idxPath, sizeof idxPath))
+        return 0;
+    fdLock   = SigIndex_Lock(idxPath, 1);
+    nEntries = SigIndex_Build(sigsPath, idxPath, 1);
+    if (fdLock != -1)
+        close(fdLock);
+    if (nEntries == -1)
+    {
+        perror(sigsPath);
+        return 0;
+    }
+    printf("%s: %ld entries\n", idxPath, nEntries);
+    return 1;
+}
+
+/*
+ * Packs the signature file, bringing its index up to date first. The lock's
+ * held throughout so the index can't change between the two.
+ */
+static int Compress(const char* sigsPath)
+{
+    char       idxPath[PATH_MAX];
+    char       packPath[PATH_MAX];
+    PackHeader hdr;
+    int        fdLock;
+    int        ok;
+
+    if (IsPacked(sigsPath, packPath))
+        return CheckPack(packPath);
+    if (!SigIndex_PathOf(sigsPath, idxPath, sizeof idxPath))
+        return 0;
+    fdLock = SigIndex_Lock(idxPath, 1);
+    ok     = SigIndex_Build(sigsPath, idxPath, 0) != -1 &&
+             SigPack_Build(sigsPath, idxPath, packPath, &hdr);
+    if (fdLock != -1)
+        close(fdLock);
+    if (!ok)
+    {
+        perror(sigsPath);
+        return 0;
+    }
+    printf("%s: %lu entries in %lu blocks, %llu bytes packed to %llu\n", packPath,
+           (unsigned long) hdr.nEntries, (unsigned long) hdr.nBlocks,
+           (unsigned long long) hdr.rawSize, (unsigned long long) hdr.packedSize);
+    return 1;
+}
+
+/*
+ * Runs `fn' over every pool in the pools file, or over .sigs if there's no
+ * pools file, returning whether it succeeded for all of them.
+ */
+static int ForEachPool(int (*fn)(const char*))
+{
+    char        path[PATH_MAX];
+    IndexHeader hdr;
+    uint32_t    iPool;
+    int         fdPools;
+    int         ok;
+
+    fdPools = SigPool_Open(POOLS_FILE, POOLS_INDEX, &hdr);
+    if (fdPools == -1)
+        return errno == ENOENT ? fn(SIGS_FILE) : 0;
+
+    ok = SigPool_Verify(fdPools, &hdr);
+    if (!ok)
+        fprintf(stderr, "%s: bad table\n", POOLS_INDEX);
+    for (iPool = 0; iPool < hdr.nEntries; iPool++)
+    {
+        if (!SigPool_Path(fdPools, &hdr, iPool, path, sizeof path) || !fn(path))
+            ok = 0;
+    }
+    close(fdPools);
+    return ok;
+}
+
+/*
+ * Picks which signature file to pick a signature from. Without a pools
+ * file, that's always .sigs. If the pools file lists none, `path' is left
+ * empty.
+ */
+static int ChoosePool(char* path)
+{
+    IndexHeader hdr;
+    int         fdPools;
+    int         ok;
+
+    fdPools = SigPool_Open(POOLS_FILE, POOLS_INDEX, &hdr);
+    if (fdPools == -1)
+    {
+        strcpy(path, SIGS_FILE);
+        return errno == ENOENT;
+    }
+    /* With no pools, there's nothing to pick. */
+    path[0] = '\0';
+    ok = hdr.nEntries == 0 ||
+         SigPool_Pick(fdPools, &hdr, SigRand_Below(hdr.nEntries), SigRand_Next(), path, PATH_MAX);
+    close(fdPools);
+    return ok;
+}
+
+/*
+ * Picks which signature to print. With `noRepeat', that's the next one in a
+ * shuffle of them all that's kept next to the signature file; if that can't
+ * be kept, it's just a random one.
+ */
+static uint32_t PickEntry(const char* sigsPath, uint32_t nEntries, int noRepeat)
+{
+    char     statePath[PATH_MAX];
+    uint32_t iEntry;
+
+    if (noRepeat &&
+        snprintf(statePath, sizeof statePath, "%s%s", sigsPath, CYCLE_SUFFIX) < (int) sizeof statePath &&
+        SigRand_NextInCycle(statePath, nEntries, &iEntry))
+        return iEntry;
+    return SigRand_Below(nEntries);
+}
+
+/*
+ * Only the one block the signature's in is read and unpacked.
+ */
+static int PrintPackedSig(const char* sigsPath, int noRepeat)
+{
+    char        packPath[PATH_MAX];
+    PackHeader  hdr;
+    char*       block;
+    const char* sig;
+    size_t      cbSig;
+    int         fdPack;
+
+    if (snprintf(packPath, sizeof packPath, "%s%s", sigsPath, PACK_SUFFIX) >= (int) sizeof packPath)
+        return 0;
+    fdPack = SigPack_Open(packPath, &hdr);
+    if (fdPack == -1)
+        return errno == ENOENT;
 
-    /* First, read and print out the fixed signature file, if it exists */
-    f = fopen(FIXED_FILE, "r");
-    if (f != NULL)
+    if (hdr.nEntries > 0 &&
+        SigPack_Fetch(fdPack, &hdr, PickEntry(sigsPath, hdr.nEntries, noRepeat), &block, &sig, &cbSig))
     {
-        while (fgets(buf, sizeof buf, f) != NULL)
-            fputs(buf, stdout);
-        fclose(f);
+        WriteAll(STDOUT_FILENO, sig, cbSig);
+        free(block);
     }
+    close(fdPack);
+    return 1;
+}
+
+static int PrintRandomSig(const char* sigsPath, int noRepeat)
+{
+    char        idxPath[PATH_MAX];
+    struct stat sb;
+    IndexHeader hdr;
+    IndexEntry  entry;
+    char*       buf;
+    int         fd;
+    int         fdIdx;
 
-    f = fopen(SIGS_FILE, "r");
-    if (f == NULL)
+    if (!SigIndex_PathOf(sigsPath, idxPath, sizeof idxPath))
         return 0;
 
+    fd = open(sigsPath, O_RDONLY);
+    if (fd == -1)
+        return errno == ENOENT ? PrintPackedSig(sigsPath, noRepeat) : 1;
+    if (fstat(fd, &sb) == -1)
+    {
+        close(fd);
+        return 0;
+    }
+
     /* Does index need to be rebuilt? */
-    if (!FileExists(INDEX_FILE) ||
-        difftime(GetModificationTime(INDEX_FILE),
-                 GetModificationTime(SIGS_FILE)) < 0)
+    fdIdx = OpenIndex(idxPath, &sb, &hdr, 1);
+    if (fdIdx == -1)
     {
-        fIdx = fopen(INDEX_FILE, "wb");
-        if (fIdx == NULL)
+        fdIdx = RefreshIndex(sigsPath, idxPath, &sb, &hdr);
+        if (fdIdx == -1)
         {
             /* Aarrgh! Can't build index! */
-            fclose(f);
-            return 1;
+            close(fd);
+            return 0;
         }
+    }
 
-        while (!feof(f))
-        {
-            fgetpos(f, &pos);
-            fwrite(&pos, sizeof(fpos_t), 1, fIdx);
+    /* Select a random entry & fetch exactly its bytes */
+    buf = NULL;
+    if (hdr.nEntries > 0)
+    {
+        if (SigIndex_ReadEntry(fdIdx, &hdr, PickEntry(sigsPath, hdr.nEntries, noRepeat), &entry) &&
+            (buf = malloc((size_t) entry.length)) != NULL &&
+            pread(fd, buf, (size_t) entry.length, (off_t) entry.offset) == (ssize_t) entry.length)
+            WriteAll(STDOUT_FILENO, buf, (size_t) entry.length);
+    }
 
-            /* Find the next signature, or the end of the file */
-            while (fgets(buf, sizeof buf, f) != NULL &&
-                   buf[0] != '%' && buf[1] != '\n');
-        }
+    free(buf);
+    close(fdIdx);
+    close(fd);
+    return 1;
+}
 
-        fclose(fIdx);
-    }
+int main(int argc, char** argv)
+{
+    char  path[PATH_MAX];
+    char* home;
+    int   noRepeat;
+    int   iArg;
+
+    /* Attempt to set the CWD to `~' */
+    home = getenv("HOME");
+    if (home != NULL)
+      chdir(home);
 
-    /* Select a random entry */
-    srand(time(NULL));
-    nEntries = (unsigned long) GetFileSize(INDEX_FILE) / sizeof(fpos_t);
-    offset   = (rand() % nEntries) * sizeof(fpos_t);
+    iArg     = 1;
+    noRepeat = argc > iArg && strcmp(argv[iArg], "--no-repeat") == 0;
+    if (noRepeat)
+        iArg++;
 
-    /* Read it in */
-    fIdx = fopen(INDEX_FILE, "rb");
-    fseek(fIdx, offset, SEEK_SET);
-    fread(&pos, sizeof(fpos_t), 1, fIdx);
-    fclose(fIdx);
+    if (argc > iArg)
+    {
+        if (strcmp(argv[iArg], "--check") == 0 && !noRepeat)
+            return ForEachPool(CheckIndex) ? 0 : 1;
+        if (strcmp(argv[iArg], "--reindex") == 0 && !noRepeat)
+        {
+            if (SigPool_Build(POOLS_FILE, POOLS_INDEX) == -1 && errno != ENOENT)
+                perror(POOLS_FILE);
+            return ForEachPool(Reindex) ? 0 : 1;
+        }
+        if (strcmp(argv[iArg], "--compress") == 0 && !noRepeat)
+            return ForEachPool(Compress) ? 0 : 1;
+        if (strcmp(argv[iArg], "--daemon") == 0)
+            return SigDaemon_Run(argc > iArg + 1 ? argv[iArg + 1] : SOCKET_FILE, noRepeat);
+        fprintf(stderr, "Usage: %s [--no-repeat] [--daemon [socket]]\n"
+                        "       %s --check | --reindex | --compress\n", argv[0], argv[0]);
+        return 1;
+    }
 
-    /* Fetch the signature & print it out */
-    fsetpos(f, &pos);
-    while (fgets(buf, sizeof buf, f) != NULL && buf[0] != '%' && buf[1] != '\n')
-        fputs(buf, stdout);
-    fclose(f);
+    /* First, print out the fixed signature file, if it exists */
+    PrintFixedSig();
 
-    return 0;
+    SigRand_Seed();
+    if (!ChoosePool(path))
+        return 1;
+    if (path[0] == '\0')
+        return 0;
+    return PrintRandomSig(path, noRepeat) ? 0 : 1;
 }
@@ -0,0 +1,62 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * ksigc.c
+ * by Keith Gaughan
+ *
+ * Fetches a signature from `ksig --daemon'.
+ *
+ * Usage: ksigc [socket]
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "sigdaemon.h"
+
+int main(int argc, char** argv)
+{
+    struct sockaddr_un addr;
+    const char*        path;
+    char               buf[BUFSIZ];
+    char*              home;
+    ssize_t            n;
+    int                fd;
+
+    /* The socket's relative to `~', as it is for the daemon. */
+    home = getenv("HOME");
+    if (home != NULL)
+      chdir(home);
+
+    path = argc > 1 ? argv[1] : SOCKET_FILE;
+    if (strlen(path) >= sizeof addr.sun_path)
+    {
+        fprintf(stderr, "%s: path too long\n", path);
+        return 1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (const struct sockaddr*) &addr, sizeof addr) == -1)
+    {
+        perror(path);
+        return 1;
+    }
+
+    while ((n = read(fd, buf, sizeof buf)) > 0)
+    {
+        if (fwrite(buf, 1, (size_t) n, stdout) != (size_t) n)
+            break;
+    }
+    close(fd);
+
+    return n == 0 ? 0 : 1;
+}
@@ -0,0 +1,644 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * sigdaemon.c
+ * by Keith Gaughan
+ *
+ * Serves random signatures over a Unix domain socket.
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sigdaemon.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "sigindex.h"
+#include "sigrand.h"
+
+/*
+ * Starting ksig for every signature means a fork, an exec, and a handful of
+ * opens and reads each time, which adds up when a mail gateway's sending
+ * thousands of them a minute. The daemon does all that once: the signature
+ * files and their indexes are mapped in, and picking a signature is a few
+ * memory reads. It's all in the one thread, with epoll telling it when
+ * there's a connection to accept or a reply that didn't fit in the socket
+ * buffer to finish sending.
+ *
+ * inotify tells it when anything it's serving from changes: .sigs, the pools
+ * file, .fixedsig, or any of the pools, at which point it all gets reloaded,
+ * rebuilding the indexes as ksig would. Changes are seen before any
+ * connections that arrive alongside them are served. A file that's
+ * truncated between the change and the reload could still fault; appending,
+ * which is the usual way the files change, is safe.
+ */
+
+#define MAX_EVENTS  64
+
+/* Changes to the home directory worth reloading for. */
+#define WATCH_DIR   (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE)
+
+/* Changes to a signature file worth reloading for. */
+#define WATCH_FILE  (IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct
+{
+    const char*          data;      /* The signature file, mapped in.     */
+    size_t               size;
+    const unsigned char* idx;       /* Its index, likewise.               */
+    size_t               cbIdx;
+    IndexHeader          hdr;
+    int                  wd;        /* Its inotify watch.                 */
+    uint64_t             key;       /* The shuffle, when not repeating.   */
+    uint32_t             cursor;
+} Source;
+
+typedef struct
+{
+    Source*              sources;   /* One per pool, or just .sigs.       */
+    uint32_t             nSources;
+    const unsigned char* pools;     /* The pools index, if there is one.  */
+    size_t               cbPools;
+    IndexHeader          poolsHdr;
+    char*                fixed;     /* The fixed signature, if any.       */
+    size_t               cbFixed;
+} Corpus;
+
+typedef struct
+{
+    char*                buf;       /* What's still to be sent.           */
+    size_t               n;
+    size_t               sent;
+} Pending;
+
+typedef struct
+{
+    int                  fdListen;
+    int                  fdNotify;
+    int                  fdEpoll;
+    int                  wdHome;
+    int                  noRepeat;
+    Corpus               corpus;
+    Pending**            pending;   /* Replies left unfinished, by fd.    */
+    size_t               cPending;
+} Server;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void OnSignal(int sig)
+{
+    (void) sig;
+    stopping = 1;
+}
+
+/*************** Loading **/
+
+static const void* MapFile(int fd, size_t* pcb)
+{
+    struct stat sb;
+    void*       p;
+
+    if (fstat(fd, &sb) == -1)
+        return NULL;
+    *pcb = (size_t) sb.st_size;
+
+    /* There's nothing to map in an empty file, but it's not an error. */
+    if (*pcb == 0)
+        return "";
+    p = mmap(NULL, *pcb, PROT_READ, MAP_SHARED, fd, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void Unmap(const void* p, size_t cb)
+{
+    if (p != NULL && cb > 0)
+        munmap((void*) p, cb);
+}
+
+static char* ReadWhole(const char* path, size_t* pcb)
+{
+    const void* p;
+    char*       buf;
+    int         fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    buf = NULL;
+    p = MapFile(fd, pcb);
+    if (p != NULL && (buf = malloc(*pcb + 1)) != NULL)
+        memcpy(buf, p, *pcb);
+    if (p != NULL)
+        Unmap(p, *pcb);
+    close(fd);
+    return buf;
+}
+
+/*
+ * Makes sure the index is up to date, rebuilding it if need be. Unlike
+ * ksig, the daemon can afford to wait for somebody else's rebuild.
+ */
+static int EnsureIndex(const char* sigsPath, const char* idxPath, const struct stat* sbSigs)
+{
+    IndexHeader hdr;
+    int         fdIdx;
+    int         fdLock;
+    int         ok;
+
+    fdIdx = open(idxPath, O_RDONLY);
+    if (fdIdx != -1)
+    {
+        ok = SigIndex_ReadHeader(fdIdx, &hdr) && SigIndex_IsCurrent(&hdr, sbSigs);
+        close(fdIdx);
+        if (ok)
+            return 1;
+    }
+
+    fdLock = SigIndex_Lock(idxPath, 1);
+    ok = SigIndex_Build(sigsPath, idxPath, 0) != -1;
+    if (fdLock != -1)
+        close(fdLock);
+    return ok;
+}
+
+static int LoadSource(Source* pSrc, const char* path, int fdNotify)
+{
+    char        idxPath[PATH_MAX];
+    struct stat sb;
+    int         fd;
+    int         ok;
+
+    memset(pSrc, 0, sizeof(Source));
+    pSrc->wd  = -1;
+    pSrc->key = SigRand_Next64();
+    if (!SigIndex_PathOf(path, idxPath, sizeof idxPath))
+        return 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    pSrc->wd = inotify_add_watch(fdNotify, path, WATCH_FILE);
+    ok = fstat(fd, &sb) == 0 && EnsureIndex(path, idxPath, &sb) &&
+         (pSrc->data = MapFile(fd, &pSrc->size)) != NULL;
+    close(fd);
+    if (!ok)
+        return 0;
+
+    fd = open(idxPath, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    ok = SigIndex_ReadHeader(fd, &pSrc->hdr) && (pSrc->idx = MapFile(fd, &pSrc->cbIdx)) != NULL;
+    close(fd);
+    if (!ok)
+        pSrc->hdr.nEntries = 0;
+    return ok;
+}
+
+static void FreeSource(Source* pSrc, int fdNotify)
+{
+    Unmap(pSrc->data, pSrc->size);
+    Unmap(pSrc->idx, pSrc->cbIdx);
+    if (pSrc->wd != -1)
+        inotify_rm_watch(fdNotify, pSrc->wd);
+}
+
+/*
+ * Loads everything there is to serve. Whatever can't be loaded is left out,
+ * and will be tried again when it next changes.
+ */
+static void Load(Corpus* pCorpus, int fdNotify)
+{
+    char     path[PATH_MAX];
+    uint32_t iPool;
+    int      fdPools;
+
+    memset(pCorpus, 0, sizeof(Corpus));
+    pCorpus->fixed = ReadWhole(FIXED_FILE, &pCorpus->cbFixed);
+
+    fdPools = SigPool_Open(POOLS_FILE, POOLS_INDEX, &pCorpus->poolsHdr);
+    if (fdPools == -1)
+    {
+        if (errno != ENOENT)
+            return;
+        pCorpus->sources = malloc(sizeof(Source));
+        if (pCorpus->sources != NULL)
+        {
+            pCorpus->nSources = 1;
+            LoadSource(pCorpus->sources, SIGS_FILE, fdNotify);
+        }
+        return;
+    }
+
+    pCorpus->pools = MapFile(fdPools, &pCorpus->cbPools);
+    if (pCorpus->pools != NULL && pCorpus->poolsHdr.nEntries > 0)
+    {
+        pCorpus->sources = malloc(pCorpus->poolsHdr.nEntries * sizeof(Source));
+        if (pCorpus->sources != NULL)
+        {
+            pCorpus->nSources = pCorpus->poolsHdr.nEntries;
+            for (iPool = 0; iPool < pCorpus->nSources; iPool++)
+            {
+                if (SigPool_Path(fdPools, &pCorpus->poolsHdr, iPool, path, sizeof path))
+                {
+                    LoadSource(&pCorpus->sources[iPool], path, fdNotify);
+                }
+                else
+                {
+                    memset(&pCorpus->sources[iPool], 0, sizeof(Source));
+                    pCorpus->sources[iPool].wd = -1;
+                }
+            }
+        }
+    }
+    close(fdPools);
+}
+
+static void FreeCorpus(Corpus* pCorpus, int fdNotify)
+{
+    uint32_t iSource;
+
+    for (iSource = 0; iSource < pCorpus->nSources; iSource++)
+        FreeSource(&pCorpus->sources[iSource], fdNotify);
+    free(pCorpus->sources);
+    Unmap(pCorpus->pools, pCorpus->cbPools);
+    free(pCorpus->fixed);
+}
+
+/*
+ * Reads whatever inotify has to say, returning whether any of it means
+ * there's something to reload.
+ */
+static int Drain(const Server* pServer)
+{
+    union
+    {
+        struct inotify_event event;
+        char                 buf[4096];
+    } u;
+    const struct inotify_event* pEvent;
+    const char*                 p;
+    ssize_t                     n;
+    int                         changed;
+
+    changed = 0;
+    while ((n = read(pServer->fdNotify, u.buf, sizeof u.buf)) > 0)
+    {
+        for (p = u.buf; p < u.buf + n; p += sizeof(struct inotify_event) + pEvent->len)
+        {
+            pEvent = (const struct inotify_event*) p;
+
+            /* We get these for the watches we remove ourselves. */
+            if (pEvent->mask & IN_IGNORED)
+                continue;
+            if (pEvent->wd != pServer->wdHome ||
+                (pEvent->len > 0 && (strcmp(pEvent->name, SIGS_FILE) == 0 ||
+                                     strcmp(pEvent->name, POOLS_FILE) == 0 ||
+                                     strcmp(pEvent->name, FIXED_FILE) == 0)))
+                changed = 1;
+        }
+    }
+    return changed;
+}
+
+/*************** Serving **/
+
+static void Pick(Corpus* pCorpus, int noRepeat, const char** pSig, size_t* pcbSig)
+{
+    Source*    pSrc;
+    IndexEntry entry;
+    uint32_t   iSource;
+    uint32_t   iEntry;
+
+    *pSig   = NULL;
+    *pcbSig = 0;
+    if (pCorpus->nSources == 0)
+        return;
+
+    iSource = 0;
+    if (pCorpus->pools != NULL)
+    {
+        iSource = SigPool_Choose(&pCorpus->poolsHdr, pCorpus->pools, pCorpus->cbPools,
+                                 SigRand_Below(pCorpus->nSources), SigRand_Next());
+        if (iSource >= pCorpus->nSources)
+            return;
+    }
+
+    pSrc = &pCorpus->sources[iSource];
+    if (pSrc->hdr.nEntries == 0)
+        return;
+    if (!noRepeat)
+    {
+        iEntry = SigRand_Below(pSrc->hdr.nEntries);
+    }
+    else
+    {
+        iEntry = SigRand_Permute(pSrc->key, pSrc->hdr.nEntries, pSrc->cursor++);
+        if (pSrc->cursor >= pSrc->hdr.nEntries)
+        {
+            pSrc->key    = SigRand_Next64();
+            pSrc->cursor = 0;
+        }
+    }
+
+    /* The file may have shrunk since it was indexed, so check again. */
+    if (!SigIndex_GetEntry(&pSrc->hdr, pSrc->idx, pSrc->cbIdx, iEntry, &entry) ||
+        entry.length > pSrc->size || entry.offset > pSrc->size - entry.length)
+        return;
+
+    *pSig   = pSrc->data + entry.offset;
+    *pcbSig = (size_t) entry.length;
+}
+
+static void Finish(Server* pServer, int fd)
+{
+    if ((size_t) fd < pServer->cPending && pServer->pending[fd] != NULL)
+    {
+        free(pServer->pending[fd]->buf);
+        free(pServer->pending[fd]);
+        pServer->pending[fd] = NULL;
+    }
+    close(fd);
+}
+
+/*
+ * Holds on to whatever didn't fit in the socket buffer, to be sent when
+ * epoll says there's room. It's copied, as the corpus could be reloaded in
+ * the meantime.
+ */
+static int Defer(Server* pServer, int fd, const struct iovec* iov, int nIov, size_t sent)
+{
+    struct epoll_event ev;
+    Pending**          pNew;
+    Pending*           p;
+    size_t             cNew;
+    size_t             n;
+    int                i;
+
+    if ((size_t) fd >= pServer->cPending)
+    {
+        cNew = (size_t) fd * 2 + 16;
+        pNew = realloc(pServer->pending, cNew * sizeof(Pending*));
+        if (pNew == NULL)
+            return 0;
+        memset(pNew + pServer->cPending, 0, (cNew - pServer->cPending) * sizeof(Pending*));
+        pServer->pending  = pNew;
+        pServer->cPending = cNew;
+    }
+
+    p = malloc(sizeof(Pending));
+    if (p == NULL)
+        return 0;
+    for (p->n = 0, i = 0; i < nIov; i++)
+        p->n += iov[i].iov_len;
+    p->sent = sent;
+    p->buf  = malloc(p->n);
+    if (p->buf == NULL)
+    {
+        free(p);
+        return 0;
+    }
+    for (n = 0, i = 0; i < nIov; i++)
+    {
+        if (iov[i].iov_len > 0)
+            memcpy(p->buf + n, iov[i].iov_base, iov[i].iov_len);
+        n += iov[i].iov_len;
+    }
+    pServer->pending[fd] = p;
+
+    ev.events  = EPOLLOUT;
+    ev.data.fd = fd;
+    return epoll_ctl(pServer->fdEpoll, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+static void Serve(Server* pServer, int fd)
+{
+    struct iovec  iov[2];
+    struct msghdr msg;
+    const char*   sig;
+    size_t        cbSig;
+    ssize_t       sent;
+
+    Pick(&pServer->corpus, pServer->noRepeat, &sig, &cbSig);
+    iov[0].iov_base = pServer->corpus.fixed;
+    iov[0].iov_len  = pServer->corpus.fixed != NULL ? pServer->corpus.cbFixed : 0;
+    iov[1].iov_base = (void*) sig;
+    iov[1].iov_len  = cbSig;
+
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = 2;
+    sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (sent == -1 && errno == EAGAIN)
+        sent = 0;
+    if (sent == -1 || (size_t) sent == iov[0].iov_len + iov[1].iov_len ||
+        !Defer(pServer, fd, iov, 2, (size_t) sent))
+        Finish(pServer, fd);
+}
+
+static void Flush(Server* pServer, int fd)
+{
+    Pending* p;
+    ssize_t  sent;
+
+    p = (size_t) fd < pServer->cPending ? pServer->pending[fd] : NULL;
+    if (p == NULL)
+    {
+        close(fd);
+        return;
+    }
+    sent = send(fd, p->buf + p->sent, p->n - p->sent, MSG_NOSIGNAL);
+    if (sent == -1 && errno == EAGAIN)
+        return;
+    if (sent > 0)
+        p->sent += (size_t) sent;
+    if (sent == -1 || p->sent == p->n)
+        Finish(pServer, fd);
+}
+
+static void Accept(Server* pServer)
+{
+    int fd;
+
+    while ((fd = accept4(pServer->fdListen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+        Serve(pServer, fd);
+}
+
+/*************** Setting Up **/
+
+/*
+ * A socket left behind by a daemon that died can be replaced; one that
+ * something's still listening on can't.
+ */
+static int InUse(const struct sockaddr_un* pAddr)
+{
+    int fd;
+    int inUse;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return 1;
+    inUse = connect(fd, (const struct sockaddr*) pAddr, sizeof(struct sockaddr_un)) == 0;
+    close(fd);
+    return inUse;
+}
+
+static int Listen(const char* sockPath)
+{
+    struct sockaddr_un addr;
+    int                fd;
+    int                ok;
+
+    if (strlen(sockPath) >= sizeof addr.sun_path)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sockPath);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return -1;
+    ok = bind(fd, (const struct sockaddr*) &addr, sizeof addr) == 0;
+    if (!ok && errno == EADDRINUSE && !InUse(&addr))
+    {
+        unlink(sockPath);
+        ok = bind(fd, (const struct sockaddr*) &addr, sizeof addr) == 0;
+    }
+    if (!ok || listen(fd, SOMAXCONN) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int Watch(int fdEpoll, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+
+    ev.events  = events;
+    ev.data.fd = fd;
+    return epoll_ctl(fdEpoll, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+int SigDaemon_Run(const char* sockPath, int noRepeat)
+{
+    struct epoll_event events[MAX_EVENTS];
+    struct sigaction   sa;
+    Server             server;
+    size_t             iFd;
+    int                nEvents;
+    int                iEvent;
+    int                reload;
+
+    memset(&server, 0, sizeof server);
+    server.noRepeat = noRepeat;
+    server.fdListen = Listen(sockPath);
+    if (server.fdListen == -1)
+    {
+        perror(sockPath);
+        return 1;
+    }
+    server.fdNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    server.fdEpoll  = epoll_create1(EPOLL_CLOEXEC);
+    if (server.fdNotify == -1 || server.fdEpoll == -1 ||
+        (server.wdHome = inotify_add_watch(server.fdNotify, ".", WATCH_DIR)) == -1 ||
+        !Watch(server.fdEpoll, server.fdListen, EPOLLIN) ||
+        !Watch(server.fdEpoll, server.fdNotify, EPOLLIN))
+    {
+        perror("ksig");
+        close(server.fdListen);
+        unlink(sockPath);
+        return 1;
+    }
+
+    /* No SA_RESTART, so that epoll_wait() is interrupted. */
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = OnSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    SigRand_Seed();
+    Load(&server.corpus, server.fdNotify);
+
+    while (!stopping)
+    {
+        nEvents = epoll_wait(server.fdEpoll, events, MAX_EVENTS, -1);
+        if (nEvents == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("ksig");
+            break;
+        }
+
+        /* Reload before serving anybody from files that have changed. */
+        reload = 0;
+        for (iEvent = 0; iEvent < nEvents; iEvent++)
+        {
+            if (events[iEvent].data.fd == server.fdNotify && Drain(&server))
+                reload = 1;
+        }
+        if (reload)
+        {
+            FreeCorpus(&server.corpus, server.fdNotify);
+            Load(&server.corpus, server.fdNotify);
+        }
+
+        for (iEvent = 0; iEvent < nEvents; iEvent++)
+        {
+            if (events[iEvent].data.fd == server.fdListen)
+                Accept(&server);
+            else if (events[iEvent].data.fd != server.fdNotify)
+                Flush(&server, events[iEvent].data.fd);
+        }
+    }
+
+    for (iFd = 0; iFd < server.cPending; iFd++)
+    {
+        if (server.pending[iFd] != NULL)
+            Finish(&server, (int) iFd);
+    }
+    free(server.pending);
+    FreeCorpus(&server.corpus, server.fdNotify);
+    close(server.fdEpoll);
+    close(server.fdNotify);
+    close(server.fdListen);
+    unlink(sockPath);
+    return 0;
+}
+
+#else
+
+int SigDaemon_Run(const char* sockPath, int noRepeat)
+{
+    (void) sockPath;
+    (void) noRepeat;
+    fputs("ksig: the daemon needs epoll and inotify, so only runs on Linux\n", stderr);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,38 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * sigdaemon.h
+ * by Keith Gaughan
+ *
+ * Serves random signatures over a Unix domain socket.
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#ifndef SIGDAEMON_H
+#define SIGDAEMON_H
+
+/* Where the daemon listens by default, relative to $HOME. */
+#define SOCKET_FILE ".ksig.sock"
+
+/**
+ * Runs the daemon until it's sent SIGINT or SIGTERM. Every connection made
+ * to the socket gets sent a signature, exactly as ksig would have printed
+ * it, and is then closed.
+ *
+ * @param  sockPath  Where to listen.
+ * @param  noRepeat  If non-zero, each pool's signatures are dealt out in a
+ *                   shuffled order, so none is repeated until they all
+ *                   have been. The shuffle starts over when the pool's
+ *                   reloaded.
+ *
+ * @return Zero if it was told to stop, non-zero if it couldn't start.
+ *
+ * @note   The current directory must be $HOME, as for the rest of ksig.
+ *         The daemon's only available on Linux; elsewhere this complains
+ *         and returns straight away.
+ */
+int SigDaemon_Run(const char* sockPath, int noRepeat);
+
+#endif
@@ -0,0 +1,889 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * sigindex.c
+ * by Keith Gaughan
+ *
+ * Builds and reads the index of a `fortune' file that ksig picks from.
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "sigindex.h"
+
+/*
+ * Index Format
+ * ============
+ *
+ * Everything's little-endian, so an index can be shared between machines.
+ *
+ *   Offset  Size  Field
+ *   ------  ----  -----
+ *        0     4  Magic, `KSIG'.
+ *        4     1  Version, INDEX_VERSION.
+ *        5     1  Width of each offset in the table: 4 or 8.
+ *        6     2  Reserved, zero.
+ *        8     4  Number of entries.
+ *       12     4  Checksum of the header, with this field zeroed.
+ *       16     4  Checksum of the table.
+ *       20     4  Nanoseconds part of the modification time of .sigs.
+ *       24     8  Device number of .sigs.
+ *       32     8  Inode number of .sigs.
+ *       40     8  Size of .sigs.
+ *       48     8  Modification time of .sigs, in seconds.
+ *       56     4  Checksum of the first PRINT_SIZE bytes of .sigs.
+ *       60     4  Checksum of the last PRINT_SIZE bytes of .sigs.
+ *
+ * The table follows, one entry per signature: its offset, `width' bytes
+ * wide, then its length in four bytes. Offsets are four bytes unless .sigs
+ * is 4GB or more, so an entry's usually eight bytes. The length of each
+ * signature is what would otherwise be the delta to the next offset, but
+ * keeping the absolute offsets means any entry can be found without
+ * reading the ones before it.
+ *
+ * The checksums are FNV-1a. The header's is checked on every run; the
+ * table's is only checked by `ksig --check', as checking it means reading
+ * all of it. Every entry's checked against the size of .sigs before use
+ * regardless, so a mangled table can't make us read outside the file.
+ */
+
+#define INDEX_MAGIC     "KSIG"
+#define INDEX_VERSION   3
+#define HEADER_SIZE     64
+#define PRINT_SIZE      4096
+#define TEMP_SUFFIX     ".XXXXXX"
+#define LOCK_SUFFIX     ".lock"
+#define POOLS_MAGIC     "KSPL"
+#define SLOT_SIZE       16
+
+static uint32_t Checksum(uint32_t h, const unsigned char* p, size_t n)
+{
+    while (n-- > 0)
+    {
+        h ^= *p++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+static void Put32(unsigned char* p, uint32_t n)
+{
+    p[0] = (unsigned char) n;
+    p[1] = (unsigned char) (n >> 8);
+    p[2] = (unsigned char) (n >> 16);
+    p[3] = (unsigned char) (n >> 24);
+}
+
+static void Put64(unsigned char* p, uint64_t n)
+{
+    Put32(p, (uint32_t) n);
+    Put32(p + 4, (uint32_t) (n >> 32));
+}
+
+static uint32_t Get32(const unsigned char* p)
+{
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t Get64(const unsigned char* p)
+{
+    return (uint64_t) Get32(p) | (uint64_t) Get32(p + 4) << 32;
+}
+
+static void SetIdentity(IndexHeader* pHdr, const struct stat* sb)
+{
+    pHdr->dev       = (uint64_t) sb->st_dev;
+    pHdr->ino       = (uint64_t) sb->st_ino;
+    pHdr->size      = (uint64_t) sb->st_size;
+    pHdr->mtime     = (int64_t) sb->st_mtime;
+    pHdr->mtimeNsec = (uint32_t) sb->st_mtim.tv_nsec;
+}
+
+int SigIndex_IsCurrent(const IndexHeader* pHdr, const struct stat* sb)
+{
+    return pHdr->dev       == (uint64_t) sb->st_dev &&
+           pHdr->ino       == (uint64_t) sb->st_ino &&
+           pHdr->size      == (uint64_t) sb->st_size &&
+           pHdr->mtime     == (int64_t) sb->st_mtime &&
+           pHdr->mtimeNsec == (uint32_t) sb->st_mtim.tv_nsec;
+}
+
+/*
+ * Checksums `length' bytes of .sigs, up to PRINT_SIZE of them, starting at
+ * `offset'. Taken at either end of the file, these are what tell us whether
+ * the file's only been appended to since it was indexed.
+ */
+static uint32_t Fingerprint(int fdSigs, uint64_t offset, uint64_t length)
+{
+    unsigned char buf[PRINT_SIZE];
+    ssize_t       n;
+
+    if (length > PRINT_SIZE)
+        length = PRINT_SIZE;
+    n = pread(fdSigs, buf, (size_t) length, (off_t) offset);
+    return Checksum(2166136261UL, buf, n > 0 ? (size_t) n : 0);
+}
+
+static void SetPrints(IndexHeader* pHdr, int fdSigs, uint64_t size)
+{
+    uint64_t length;
+
+    length = size < PRINT_SIZE ? size : PRINT_SIZE;
+    pHdr->headPrint = Fingerprint(fdSigs, 0, length);
+    pHdr->tailPrint = Fingerprint(fdSigs, size - length, length);
+}
+
+static void EncodeHeader(const IndexHeader* pHdr, const char* magic, unsigned char* buf)
+{
+    memset(buf, 0, HEADER_SIZE);
+    memcpy(buf, magic, 4);
+    buf[4] = INDEX_VERSION;
+    buf[5] = (unsigned char) pHdr->width;
+    Put32(buf + 8, pHdr->nEntries);
+    Put32(buf + 16, pHdr->tableSum);
+    Put32(buf + 20, pHdr->mtimeNsec);
+    Put64(buf + 24, pHdr->dev);
+    Put64(buf + 32, pHdr->ino);
+    Put64(buf + 40, pHdr->size);
+    Put64(buf + 48, (uint64_t) pHdr->mtime);
+    Put32(buf + 56, pHdr->headPrint);
+    Put32(buf + 60, pHdr->tailPrint);
+    Put32(buf + 12, Checksum(2166136261UL, buf, HEADER_SIZE));
+}
+
+static int DecodeHeader(const unsigned char* buf, const char* magic, IndexHeader* pHdr)
+{
+    unsigned char copy[HEADER_SIZE];
+
+    if (memcmp(buf, magic, 4) != 0 || buf[4] != INDEX_VERSION ||
+        (buf[5] != 4 && buf[5] != 8))
+        return 0;
+
+    memcpy(copy, buf, HEADER_SIZE);
+    memset(copy + 12, 0, 4);
+    if (Checksum(2166136261UL, copy, HEADER_SIZE) != Get32(buf + 12))
+        return 0;
+
+    pHdr->width     = buf[5];
+    pHdr->nEntries  = Get32(buf + 8);
+    pHdr->tableSum  = Get32(buf + 16);
+    pHdr->mtimeNsec = Get32(buf + 20);
+    pHdr->dev       = Get64(buf + 24);
+    pHdr->ino       = Get64(buf + 32);
+    pHdr->size      = Get64(buf + 40);
+    pHdr->mtime     = (int64_t) Get64(buf + 48);
+    pHdr->headPrint = Get32(buf + 56);
+    pHdr->tailPrint = Get32(buf + 60);
+    return 1;
+}
+
+static void EncodeEntry(const IndexHeader* pHdr, const IndexEntry* pEntry, unsigned char* buf)
+{
+    if (pHdr->width == 8)
+        Put64(buf, pEntry->offset);
+    else
+        Put32(buf, (uint32_t) pEntry->offset);
+    Put32(buf + pHdr->width, (uint32_t) pEntry->length);
+}
+
+static void DecodeEntry(const IndexHeader* pHdr, const unsigned char* buf, IndexEntry* pEntry)
+{
+    pEntry->offset = pHdr->width == 8 ? Get64(buf) : Get32(buf);
+    pEntry->length = Get32(buf + pHdr->width);
+}
+
+int SigIndex_ReadHeader(int fdIdx, IndexHeader* pHdr)
+{
+    unsigned char buf[HEADER_SIZE];
+
+    return pread(fdIdx, buf, sizeof buf, 0) == (ssize_t) sizeof buf &&
+           DecodeHeader(buf, INDEX_MAGIC, pHdr);
+}
+
+int SigIndex_PathOf(const char* sigsPath, char* idxPath, size_t cbIdxPath)
+{
+    return (size_t) snprintf(idxPath, cbIdxPath, "%s%s", sigsPath, INDEX_SUFFIX) < cbIdxPath;
+}
+
+static int InFile(const IndexHeader* pHdr, const IndexEntry* pEntry)
+{
+    return pEntry->length <= pHdr->size && pEntry->offset <= pHdr->size - pEntry->length;
+}
+
+int SigIndex_ReadEntry(int fdIdx, const IndexHeader* pHdr, uint32_t iEntry, IndexEntry* pEntry)
+{
+    unsigned char buf[12];
+    size_t        n;
+
+    n = pHdr->width + 4;
+    if (pread(fdIdx, buf, n, (off_t) (HEADER_SIZE + (uint64_t) iEntry * n)) != (ssize_t) n)
+        return 0;
+    DecodeEntry(pHdr, buf, pEntry);
+    return InFile(pHdr, pEntry);
+}
+
+int SigIndex_GetEntry(const IndexHeader* pHdr, const void* idx, size_t cbIdx,
+                      uint32_t iEntry, IndexEntry* pEntry)
+{
+    size_t n;
+
+    n = pHdr->width + 4;
+    if (iEntry >= pHdr->nEntries || HEADER_SIZE + ((uint64_t) iEntry + 1) * n > cbIdx)
+        return 0;
+    DecodeEntry(pHdr, (const unsigned char*) idx + HEADER_SIZE + (size_t) iEntry * n, pEntry);
+    return InFile(pHdr, pEntry);
+}
+
+int SigIndex_ReadTable(FILE* fIdx, const IndexHeader* pHdr, IndexEntry* entries)
+{
+    unsigned char buf[12];
+    IndexEntry    entry;
+    uint32_t      sum;
+    uint32_t      iEntry;
+    size_t        n;
+
+    if (fseek(fIdx, HEADER_SIZE, SEEK_SET) != 0)
+        return 0;
+
+    n   = pHdr->width + 4;
+    sum = 2166136261UL;
+    for (iEntry = 0; iEntry < pHdr->nEntries; iEntry++)
+    {
+        if (fread(buf, 1, n, fIdx) != n)
+            return 0;
+        sum = Checksum(sum, buf, n);
+        DecodeEntry(pHdr, buf, &entry);
+        if (!InFile(pHdr, &entry))
+            return 0;
+        if (entries != NULL)
+            entries[iEntry] = entry;
+    }
+    return sum == pHdr->tableSum;
+}
+
+static int AddEntry(IndexEntry** pEntries, uint32_t* pnEntries, size_t* pcEntries,
+                    off_t offset, off_t length)
+{
+    IndexEntry* pNew;
+
+    /* Blank signatures aren't worth printing. */
+    if (length <= 0)
+        return 1;
+    /* Nor would one that doesn't fit in the table be. */
+    if ((uint64_t) length > 0xFFFFFFFFUL)
+        return 0;
+
+    if (*pnEntries == *pcEntries)
+    {
+        pNew = realloc(*pEntries, (*pcEntries * 2 + 64) * sizeof(IndexEntry));
+        if (pNew == NULL)
+            return 0;
+        *pEntries  = pNew;
+        *pcEntries = *pcEntries * 2 + 64;
+    }
+
+    (*pEntries)[*pnEntries].offset = (uint64_t) offset;
+    (*pEntries)[*pnEntries].length = (uint64_t) length;
+    (*pnEntries)++;
+    return 1;
+}
+
+/*
+ * Appends `suffix' to `path' in a freshly allocated string.
+ */
+static char* WithSuffix(const char* path, const char* suffix)
+{
+    char* pNew;
+
+    pNew = malloc(strlen(path) + strlen(suffix) + 1);
+    if (pNew != NULL)
+        strcat(strcpy(pNew, path), suffix);
+    return pNew;
+}
+
+/*
+ * Indexes are written to a temporary file alongside them and renamed into
+ * place, so anybody reading one sees either the old index or the new one,
+ * never half of one.
+ */
+static FILE* CreateTemp(const char* path, char** pTmpPath)
+{
+    FILE* f;
+    int   fd;
+
+    *pTmpPath = WithSuffix(path, TEMP_SUFFIX);
+    if (*pTmpPath == NULL)
+        return NULL;
+    fd = mkstemp(*pTmpPath);
+    if (fd == -1)
+    {
+        free(*pTmpPath);
+        return NULL;
+    }
+    f = fdopen(fd, "wb");
+    if (f == NULL)
+    {
+        close(fd);
+        unlink(*pTmpPath);
+        free(*pTmpPath);
+    }
+    return f;
+}
+
+/*
+ * Closes the temporary file and, if all went well, renames it over `path'.
+ * Otherwise it's thrown away.
+ */
+static int ReplaceWithTemp(FILE* f, char* tmpPath, const char* path, int ok)
+{
+    if (ferror(f))
+        ok = 0;
+    if (fclose(f) != 0)
+        ok = 0;
+    if (ok)
+        ok = rename(tmpPath, path) == 0;
+    if (!ok)
+        unlink(tmpPath);
+    free(tmpPath);
+    return ok;
+}
+
+static int WriteIndex(const char* idxPath, IndexHeader* pHdr, const IndexEntry* entries)
+{
+    unsigned char buf[HEADER_SIZE];
+    FILE*         fIdx;
+    char*         tmpPath;
+    size_t        n;
+    uint32_t      iEntry;
+
+    fIdx = CreateTemp(idxPath, &tmpPath);
+    if (fIdx == NULL)
+        return 0;
+
+    /* Leave room for the header until the table's checksum is known. */
+    n = pHdr->width + 4;
+    pHdr->tableSum = 2166136261UL;
+    memset(buf, 0, HEADER_SIZE);
+    fwrite(buf, 1, HEADER_SIZE, fIdx);
+    for (iEntry = 0; iEntry < pHdr->nEntries; iEntry++)
+    {
+        EncodeEntry(pHdr, &entries[iEntry], buf);
+        pHdr->tableSum = Checksum(pHdr->tableSum, buf, n);
+        fwrite(buf, 1, n, fIdx);
+    }
+
+    EncodeHeader(pHdr, INDEX_MAGIC, buf);
+    return ReplaceWithTemp(fIdx, tmpPath, idxPath,
+                           fseek(fIdx, 0, SEEK_SET) == 0 &&
+                           fwrite(buf, 1, HEADER_SIZE, fIdx) == HEADER_SIZE);
+}
+
+/*
+ * The signature file's mostly appended to, so if it's the same file as was
+ * indexed and has only grown, the old entries are kept and only what's past
+ * them gets scanned. The last old entry's dropped and scanned again, as the
+ * append may have carried on from it.
+ *
+ * Checksumming all of the old part of the file to be sure it hasn't changed
+ * would cost as much as scanning it, so only the first and last PRINT_SIZE
+ * bytes of it are compared. An edit elsewhere that also grows the file will
+ * go unnoticed until the index is next rebuilt from scratch, but every entry
+ * is still within the file, so the worst we'll print is a torn signature.
+ *
+ * Returns where scanning should start, with any entries kept in `entries'.
+ */
+static off_t ReuseIndex(const char* idxPath, int fdSigs, const struct stat* sbSigs,
+                        IndexEntry** pEntries, uint32_t* pnEntries, size_t* pcEntries)
+{
+    IndexHeader old;
+    FILE*       fIdx;
+    uint64_t    length;
+
+    fIdx = fopen(idxPath, "rb");
+    if (fIdx == NULL)
+        return 0;
+
+    length = 0;
+    if (!SigIndex_ReadHeader(fileno(fIdx), &old) || old.nEntries == 0 ||
+        old.dev != (uint64_t) sbSigs->st_dev || old.ino != (uint64_t) sbSigs->st_ino ||
+        old.size >= (uint64_t) sbSigs->st_size)
+        goto FULL;
+
+    length = old.size < PRINT_SIZE ? old.size : PRINT_SIZE;
+    if (Fingerprint(fdSigs, 0, length) != old.headPrint ||
+        Fingerprint(fdSigs, old.size - length, length) != old.tailPrint)
+        goto FULL;
+
+    *pEntries = malloc(((size_t) old.nEntries + 64) * sizeof(IndexEntry));
+    if (*pEntries == NULL)
+        goto FULL;
+    *pcEntries = (size_t) old.nEntries + 64;
+    if (!SigIndex_ReadTable(fIdx, &old, *pEntries))
+        goto FULL;
+    fclose(fIdx);
+
+    *pnEntries = old.nEntries - 1;
+    return (off_t) (*pEntries)[*pnEntries].offset;
+
+FULL:
+    fclose(fIdx);
+    free(*pEntries);
+    *pEntries  = NULL;
+    *pcEntries = 0;
+    *pnEntries = 0;
+    return 0;
+}
+
+/*
+ * Signatures are separated by lines consisting of nothing but a `%', the
+ * last of which may be missing its newline. As `%' is rarer than newlines,
+ * it's what's searched for, and memchr() is left to do that as fast as the
+ * C library can manage, which on anything recent means a word or a vector
+ * at a time. Lines can be as long as they like.
+ */
+static int Scan(const char* data, uint64_t size, uint64_t start,
+                IndexEntry** pEntries, uint32_t* pnEntries, size_t* pcEntries)
+{
+    const char* p;
+    const char* end;
+
+    end = data + size;
+    p   = data + start;
+    while ((p = memchr(p, '%', (size_t) (end - p))) != NULL)
+    {
+        if ((p == data || p[-1] == '\n') && (p + 1 == end || p[1] == '\n'))
+        {
+            if (!AddEntry(pEntries, pnEntries, pcEntries,
+                          (off_t) start, (off_t) (p - data - start)))
+                return 0;
+            p     = p + 1 == end ? end : p + 2;
+            start = (uint64_t) (p - data);
+        }
+        else
+        {
+            p++;
+        }
+        if (p == end)
+            break;
+    }
+    return AddEntry(pEntries, pnEntries, pcEntries, (off_t) start, (off_t) (size - start));
+}
+
+long SigIndex_Build(const char* sigsPath, const char* idxPath, int full)
+{
+    struct stat sb;
+    IndexHeader hdr;
+    IndexEntry* entries;
+    size_t      cEntries;
+    uint64_t    start;
+    void*       data;
+    int         fd;
+    int         ok;
+
+    fd = open(sigsPath, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &sb) == -1 || (uint64_t) sb.st_size != (uint64_t) (size_t) sb.st_size)
+    {
+        close(fd);
+        return -1;
+    }
+
+    entries      = NULL;
+    cEntries     = 0;
+    hdr.nEntries = 0;
+    hdr.width    = (uint64_t) sb.st_size > 0xFFFFFFFFUL ? 8 : 4;
+    SetIdentity(&hdr, &sb);
+    SetPrints(&hdr, fd, hdr.size);
+
+    start = 0;
+    if (!full)
+        start = (uint64_t) ReuseIndex(idxPath, fd, &sb, &entries, &hdr.nEntries, &cEntries);
+
+    /* There's nothing to map in an empty file, and mmap() won't try. */
+    ok = 1;
+    if (hdr.size > 0)
+    {
+        data = mmap(NULL, (size_t) hdr.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            ok = 0;
+        }
+        else
+        {
+            posix_madvise(data, (size_t) hdr.size, POSIX_MADV_SEQUENTIAL);
+            ok = Scan((const char*) data, hdr.size, start, &entries, &hdr.nEntries, &cEntries);
+            munmap(data, (size_t) hdr.size);
+        }
+    }
+    close(fd);
+
+    if (ok)
+        ok = WriteIndex(idxPath, &hdr, entries);
+    free(entries);
+    return ok ? (long) hdr.nEntries : -1;
+}
+
+int SigIndex_Lock(const char* idxPath, int wait)
+{
+    struct flock fl;
+    char*        lockPath;
+    int          fd;
+    int          err;
+
+    lockPath = WithSuffix(idxPath, LOCK_SUFFIX);
+    if (lockPath == NULL)
+        return -1;
+    fd = open(lockPath, O_RDWR | O_CREAT, 0644);
+    free(lockPath);
+    if (fd == -1)
+        return -1;
+
+    memset(&fl, 0, sizeof fl);
+    fl.l_type   = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(fd, wait ? F_SETLKW : F_SETLK, &fl) == -1)
+    {
+        if (errno == EINTR)
+            continue;
+        err = errno == EACCES ? EAGAIN : errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Pools
+ * =====
+ *
+ * A pools file lists signature files to pick from, one per line, each with
+ * its weight in front of it:
+ *
+ *     3    .sigs
+ *     1    projects/ksig/sigs
+ *     0.5  lists/cranks
+ *
+ * A pool's weight is its share of the picks, whatever its size; within a
+ * pool, every signature's as likely as any other. Lines that don't make
+ * sense, or have a weight that isn't positive, are ignored.
+ *
+ * The pools index has the same header as a signature index, but with the
+ * magic `KSPL', and with the pools file's identity and the number of pools
+ * in it. A table of alias slots follows, one per pool, each of them sixteen
+ * bytes:
+ *
+ *   Offset  Size  Field
+ *   ------  ----  -----
+ *        0     4  Chance of staying with this slot's pool, out of 2^32.
+ *        4     4  The pool to go to otherwise.
+ *        8     4  Offset of the pool's path in the file.
+ *       12     4  Length of the pool's path.
+ *
+ * and then the paths. Picking a slot uniformly and then either staying with
+ * it or going to its alias picks each pool in proportion to its weight
+ * (Walker's alias method, built with Vose's algorithm), and takes two reads
+ * however many pools there are.
+ */
+
+typedef struct
+{
+    double   weight;
+    char*    path;
+    uint32_t threshold;
+    uint32_t alias;
+} Pool;
+
+static void FreePools(Pool* pools, uint32_t nPools)
+{
+    uint32_t iPool;
+
+    for (iPool = 0; iPool < nPools; iPool++)
+        free(pools[iPool].path);
+    free(pools);
+}
+
+/*
+ * Reads in the pools file, returning the pools and their number, or -1 if
+ * it couldn't be read.
+ */
+static long ReadPools(FILE* f, Pool** pPools)
+{
+    char     line[4096];
+    Pool*    pNew;
+    char*    p;
+    char*    end;
+    double   weight;
+    uint32_t nPools;
+    size_t   cPools;
+    size_t   n;
+
+    *pPools = NULL;
+    nPools  = 0;
+    cPools  = 0;
+    while (fgets(line, sizeof line, f) != NULL)
+    {
+        weight = strtod(line, &end);
+        if (end == line || !(weight > 0) || (*end != ' ' && *end != '\t'))
+            continue;
+        for (p = end; *p == ' ' || *p == '\t'; p++)
+            ;
+        for (n = strlen(p); n > 0 && (p[n - 1] == '\n' || p[n - 1] == '\r' ||
+                                      p[n - 1] == ' ' || p[n - 1] == '\t'); n--)
+            ;
+        if (n == 0)
+            continue;
+
+        if (nPools == cPools)
+        {
+            pNew = realloc(*pPools, (cPools * 2 + 8) * sizeof(Pool));
+            if (pNew == NULL)
+                goto CATASTROPHE;
+            *pPools = pNew;
+            cPools  = cPools * 2 + 8;
+        }
+        (*pPools)[nPools].path = malloc(n + 1);
+        if ((*pPools)[nPools].path == NULL)
+            goto CATASTROPHE;
+        memcpy((*pPools)[nPools].path, p, n);
+        (*pPools)[nPools].path[n] = '\0';
+        (*pPools)[nPools].weight  = weight;
+        nPools++;
+    }
+    if (ferror(f))
+        goto CATASTROPHE;
+    return (long) nPools;
+
+CATASTROPHE:
+    FreePools(*pPools, nPools);
+    *pPools = NULL;
+    return -1;
+}
+
+/*
+ * Builds the alias table with Vose's algorithm. Each pool's weight is
+ * scaled so they average one; pools below one get topped up from pools
+ * above it, which become their aliases.
+ */
+static int BuildAliases(Pool* pools, uint32_t nPools)
+{
+    uint32_t* small;
+    uint32_t* large;
+    uint32_t  nSmall;
+    uint32_t  nLarge;
+    uint32_t  iPool;
+    uint32_t  iSmall;
+    uint32_t  iLarge;
+    double    total;
+
+    small = malloc((nPools + 1) * sizeof(uint32_t));
+    large = malloc((nPools + 1) * sizeof(uint32_t));
+    if (small == NULL || large == NULL)
+    {
+        free(small);
+        free(large);
+        return 0;
+    }
+
+    total = 0;
+    for (iPool = 0; iPool < nPools; iPool++)
+        total += pools[iPool].weight;
+
+    nSmall = 0;
+    nLarge = 0;
+    for (iPool = 0; iPool < nPools; iPool++)
+    {
+        pools[iPool].weight = pools[iPool].weight * nPools / total;
+        pools[iPool].alias  = iPool;
+        if (pools[iPool].weight < 1)
+            small[nSmall++] = iPool;
+        else
+            large[nLarge++] = iPool;
+    }
+
+    while (nSmall > 0 && nLarge > 0)
+    {
+        iSmall = small[--nSmall];
+        iLarge = large[nLarge - 1];
+        pools[iSmall].threshold = (uint32_t) (pools[iSmall].weight * 4294967296.0);
+        pools[iSmall].alias     = iLarge;
+        pools[iLarge].weight   -= 1 - pools[iSmall].weight;
+        if (pools[iLarge].weight < 1)
+        {
+            nLarge--;
+            small[nSmall++] = iLarge;
+        }
+    }
+
+    /* Whatever's left is, give or take rounding, exactly one. */
+    while (nLarge > 0)
+        pools[large[--nLarge]].threshold = 0xFFFFFFFFUL;
+    while (nSmall > 0)
+        pools[small[--nSmall]].threshold = 0xFFFFFFFFUL;
+
+    free(small);
+    free(large);
+    return 1;
+}
+
+long SigPool_Build(const char* confPath, const char* idxPath)
+{
+    unsigned char buf[HEADER_SIZE];
+    struct stat   sb;
+    IndexHeader   hdr;
+    FILE*         f;
+    FILE*         fIdx;
+    Pool*         pools;
+    char*         tmpPath;
+    uint32_t      iPool;
+    uint32_t      offset;
+    long          nPools;
+    int           ok;
+
+    f = fopen(confPath, "r");
+    if (f == NULL)
+        return -1;
+    if (fstat(fileno(f), &sb) == -1 || (nPools = ReadPools(f, &pools)) == -1)
+    {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    memset(&hdr, 0, sizeof hdr);
+    hdr.width    = 4;
+    hdr.nEntries = (uint32_t) nPools;
+    SetIdentity(&hdr, &sb);
+
+    fIdx = NULL;
+    if (!BuildAliases(pools, hdr.nEntries) || (fIdx = CreateTemp(idxPath, &tmpPath)) == NULL)
+    {
+        FreePools(pools, hdr.nEntries);
+        return -1;
+    }
+
+    /* Leave room for the header until the table's checksum is known. */
+    memset(buf, 0, sizeof buf);
+    fwrite(buf, 1, HEADER_SIZE, fIdx);
+    hdr.tableSum = 2166136261UL;
+    offset = HEADER_SIZE + hdr.nEntries * SLOT_SIZE;
+    for (iPool = 0; iPool < hdr.nEntries; iPool++)
+    {
+        Put32(buf, pools[iPool].threshold);
+        Put32(buf + 4, pools[iPool].alias);
+        Put32(buf + 8, offset);
+        Put32(buf + 12, (uint32_t) strlen(pools[iPool].path));
+        hdr.tableSum = Checksum(hdr.tableSum, buf, SLOT_SIZE);
+        fwrite(buf, 1, SLOT_SIZE, fIdx);
+        offset += (uint32_t) strlen(pools[iPool].path);
+    }
+    for (iPool = 0; iPool < hdr.nEntries; iPool++)
+    {
+        hdr.tableSum = Checksum(hdr.tableSum, (unsigned char*) pools[iPool].path,
+                                strlen(pools[iPool].path));
+        fputs(pools[iPool].path, fIdx);
+    }
+    FreePools(pools, hdr.nEntries);
+
+    EncodeHeader(&hdr, POOLS_MAGIC, buf);
+    ok = ReplaceWithTemp(fIdx, tmpPath, idxPath,
+                         fseek(fIdx, 0, SEEK_SET) == 0 &&
+                         fwrite(buf, 1, HEADER_SIZE, fIdx) == HEADER_SIZE);
+    return ok ? nPools : -1;
+}
+
+int SigPool_Open(const char* confPath, const char* idxPath, IndexHeader* pHdr)
+{
+    unsigned char buf[HEADER_SIZE];
+    struct stat   sb;
+    int           fdIdx;
+    int           tries;
+
+    if (stat(confPath, &sb) == -1)
+        return -1;
+
+    /* If it's out of date, rebuild it and try again, but only the once. */
+    for (tries = 0; tries < 2; tries++)
+    {
+        if (tries > 0 && SigPool_Build(confPath, idxPath) == -1)
+            break;
+        fdIdx = open(idxPath, O_RDONLY);
+        if (fdIdx == -1)
+            continue;
+        if (pread(fdIdx, buf, sizeof buf, 0) == (ssize_t) sizeof buf &&
+            DecodeHeader(buf, POOLS_MAGIC, pHdr) && SigIndex_IsCurrent(pHdr, &sb))
+            return fdIdx;
+        close(fdIdx);
+    }
+
+    /* Keep ENOENT for when there's no pools file at all. */
+    if (errno == ENOENT)
+        errno = EIO;
+    return -1;
+}
+
+int SigPool_Path(int fdIdx, const IndexHeader* pHdr, uint32_t iPool, char* path, size_t cbPath)
+{
+    unsigned char buf[SLOT_SIZE];
+    uint32_t      length;
+
+    if (iPool >= pHdr->nEntries ||
+        pread(fdIdx, buf, SLOT_SIZE, (off_t) (HEADER_SIZE + (uint64_t) iPool * SLOT_SIZE)) != SLOT_SIZE)
+        return 0;
+    length = Get32(buf + 12);
+    if (length >= cbPath || pread(fdIdx, path, length, (off_t) Get32(buf + 8)) != (ssize_t) length)
+        return 0;
+    path[length] = '\0';
+    return 1;
+}
+
+int SigPool_Pick(int fdIdx, const IndexHeader* pHdr, uint32_t iSlot, uint32_t coin,
+                 char* path, size_t cbPath)
+{
+    unsigned char buf[SLOT_SIZE];
+
+    if (iSlot >= pHdr->nEntries ||
+        pread(fdIdx, buf, SLOT_SIZE, (off_t) (HEADER_SIZE + (uint64_t) iSlot * SLOT_SIZE)) != SLOT_SIZE)
+        return 0;
+    if (coin >= Get32(buf))
+        iSlot = Get32(buf + 4);
+    return SigPool_Path(fdIdx, pHdr, iSlot, path, cbPath);
+}
+
+uint32_t SigPool_Choose(const IndexHeader* pHdr, const void* idx, size_t cbIdx,
+                        uint32_t iSlot, uint32_t coin)
+{
+    const unsigned char* slot;
+
+    if (iSlot >= pHdr->nEntries || HEADER_SIZE + ((uint64_t) iSlot + 1) * SLOT_SIZE > cbIdx)
+        return pHdr->nEntries;
+    slot = (const unsigned char*) idx + HEADER_SIZE + (size_t) iSlot * SLOT_SIZE;
+    if (coin >= Get32(slot))
+        iSlot = Get32(slot + 4);
+    return iSlot < pHdr->nEntries ? iSlot : pHdr->nEntries;
+}
+
+int SigPool_Verify(int fdIdx, const IndexHeader* pHdr)
+{
+    unsigned char buf[BUFSIZ];
+    uint32_t      sum;
+    off_t         offset;
+    ssize_t       n;
+
+    sum    = 2166136261UL;
+    offset = HEADER_SIZE;
+    while ((n = pread(fdIdx, buf, sizeof buf, offset)) > 0)
+    {
+        sum     = Checksum(sum, buf, (size_t) n);
+        offset += n;
+    }
+    return n == 0 && sum == pHdr->tableSum;
+}
@@ -0,0 +1,229 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * sigindex.h
+ * by Keith Gaughan
+ *
+ * Builds and reads the index of a `fortune' file that ksig picks from.
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#ifndef SIGINDEX_H
+#define SIGINDEX_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Where ksig looks for things, relative to $HOME. */
+#define SIGS_FILE       ".sigs"
+#define POOLS_FILE      ".sigpools"
+#define POOLS_INDEX     ".sigpools.idx"
+#define FIXED_FILE      ".fixedsig"
+
+/* The index of a signature file is named after it, with this on the end. */
+#define INDEX_SUFFIX    ".idx"
+
+typedef struct
+{
+    unsigned width;         /* Bytes per offset in the table.           */
+    uint32_t nEntries;      /* Number of signatures.                    */
+    uint32_t tableSum;      /* Checksum of the table.                   */
+    uint32_t mtimeNsec;     /* Identity of the signature file indexed.  */
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t  mtime;
+    uint32_t headPrint;     /* Checksums of either end of it.           */
+    uint32_t tailPrint;
+} IndexHeader;
+
+typedef struct
+{
+    uint64_t offset;        /* Where the signature starts.              */
+    uint64_t length;        /* Its length, excluding the `%' line.      */
+} IndexEntry;
+
+/**
+ * Reads the header of an index and checks it's intact.
+ *
+ * @param  fdIdx  Descriptor of the index.
+ * @param  pHdr   Filled in with the header.
+ *
+ * @return Non-zero if the header could be read and its checksum matches.
+ *
+ * @note   Whether the index is up to date is another matter. Use
+ *         SigIndex_IsCurrent() for that.
+ */
+int SigIndex_ReadHeader(int fdIdx, IndexHeader* pHdr);
+
+/**
+ * Checks whether an index was built from the signature file as it is now.
+ *
+ * @param  pHdr    The header of the index.
+ * @param  sbSigs  Result of stat() on the signature file.
+ *
+ * @return Non-zero if it was.
+ */
+int SigIndex_IsCurrent(const IndexHeader* pHdr, const struct stat* sbSigs);
+
+/**
+ * Works out the name of a signature file's index.
+ *
+ * @param  sigsPath   The signature file.
+ * @param  idxPath    Filled in with the name of its index.
+ * @param  cbIdxPath  Size of `idxPath'.
+ *
+ * @return Non-zero if it fitted.
+ */
+int SigIndex_PathOf(const char* sigsPath, char* idxPath, size_t cbIdxPath);
+
+/**
+ * Reads a single entry from the table.
+ *
+ * @param  fdIdx   Descriptor of the index.
+ * @param  pHdr    The header of the index.
+ * @param  iEntry  Which entry; must be less than pHdr->nEntries.
+ * @param  pEntry  Filled in with the entry.
+ *
+ * @return Non-zero if the entry could be read and lies within the
+ *         signature file.
+ */
+int SigIndex_ReadEntry(int fdIdx, const IndexHeader* pHdr, uint32_t iEntry, IndexEntry* pEntry);
+
+/**
+ * Fetches a single entry from the table of an index that's in memory.
+ *
+ * @param  pHdr    The header of the index.
+ * @param  idx     The whole of the index, header and all.
+ * @param  cbIdx   Its size.
+ * @param  iEntry  Which entry.
+ * @param  pEntry  Filled in with the entry.
+ *
+ * @return Non-zero if the entry exists and lies within the signature file.
+ */
+int SigIndex_GetEntry(const IndexHeader* pHdr, const void* idx, size_t cbIdx,
+                      uint32_t iEntry, IndexEntry* pEntry);
+
+/**
+ * Reads the whole table, checking it against its checksum and every entry
+ * against the size of the signature file.
+ *
+ * @param  fIdx     The index.
+ * @param  pHdr     The header of the index.
+ * @param  entries  Filled in with pHdr->nEntries entries, or NULL if only
+ *                  the check's wanted.
+ *
+ * @return Non-zero if the table's intact.
+ */
+int SigIndex_ReadTable(FILE* fIdx, const IndexHeader* pHdr, IndexEntry* entries);
+
+/**
+ * Indexes a signature file.
+ *
+ * @param  sigsPath  The signature file.
+ * @param  idxPath   Where to write the index.
+ * @param  full      If zero, an existing index is brought up to date by
+ *                   scanning only what's been appended to the file since,
+ *                   where possible. If non-zero, the whole file's scanned.
+ *
+ * @return The number of signatures indexed, or -1 on failure.
+ */
+long SigIndex_Build(const char* sigsPath, const char* idxPath, int full);
+
+/**
+ * Takes the lock on rebuilding an index, so that when many processes find
+ * it out of date at once, only one of them rebuilds it.
+ *
+ * @param  idxPath  The index. The lock is taken on a file next to it with
+ *                  `.lock' on the end of its name.
+ * @param  wait     If non-zero, wait for whoever has the lock to let go.
+ *
+ * @return A descriptor to close() to release the lock, or -1 on failure.
+ *         If `wait' is zero and someone else has the lock, errno is set to
+ *         EAGAIN.
+ *
+ * @note   The lock's advisory. SigIndex_Build() doesn't take it itself,
+ *         and needn't be holding it to be safe, as the new index replaces
+ *         the old one in a single rename().
+ */
+int SigIndex_Lock(const char* idxPath, int wait);
+
+/**
+ * Indexes a pools file: a list of signature files, each with a weight.
+ *
+ * @param  confPath  The pools file.
+ * @param  idxPath   Where to write its index.
+ *
+ * @return The number of pools, or -1 on failure.
+ */
+long SigPool_Build(const char* confPath, const char* idxPath);
+
+/**
+ * Opens the index of a pools file, rebuilding it first if it's missing or
+ * out of date.
+ *
+ * @param  confPath  The pools file.
+ * @param  idxPath   Its index.
+ * @param  pHdr      Filled in with the header of the index. Its nEntries
+ *                   is the number of pools.
+ *
+ * @return Descriptor of the index, or -1 on failure. If the pools file
+ *         doesn't exist, errno is ENOENT.
+ */
+int SigPool_Open(const char* confPath, const char* idxPath, IndexHeader* pHdr);
+
+/**
+ * Picks a pool, with the odds of each being picked set by its weight.
+ *
+ * @param  fdIdx   Descriptor of the index.
+ * @param  pHdr    Its header.
+ * @param  iSlot   A random number less than pHdr->nEntries.
+ * @param  coin    A random number over the full 32 bits.
+ * @param  path    Filled in with the path of the pool's signature file.
+ * @param  cbPath  Size of `path'.
+ *
+ * @return Non-zero on success.
+ */
+int SigPool_Pick(int fdIdx, const IndexHeader* pHdr, uint32_t iSlot, uint32_t coin,
+                 char* path, size_t cbPath);
+
+/**
+ * Picks a pool, as SigPool_Pick() does, from a pools index that's in memory.
+ *
+ * @param  pHdr   The header of the index.
+ * @param  idx    The whole of the index, header and all.
+ * @param  cbIdx  Its size.
+ * @param  iSlot  A random number less than pHdr->nEntries.
+ * @param  coin   A random number over the full 32 bits.
+ *
+ * @return The number of the pool picked, or pHdr->nEntries if the index
+ *         is damaged.
+ */
+uint32_t SigPool_Choose(const IndexHeader* pHdr, const void* idx, size_t cbIdx,
+                        uint32_t iSlot, uint32_t coin);
+
+/**
+ * Fetches the path of a pool's signature file.
+ *
+ * @param  fdIdx   Descriptor of the index.
+ * @param  pHdr    Its header.
+ * @param  iPool   Which pool; must be less than pHdr->nEntries.
+ * @param  path    Filled in with the path.
+ * @param  cbPath  Size of `path'.
+ *
+ * @return Non-zero on success.
+ */
+int SigPool_Path(int fdIdx, const IndexHeader* pHdr, uint32_t iPool, char* path, size_t cbPath);
+
+/**
+ * Checks the table and paths of a pools index against their checksum.
+ *
+ * @return Non-zero if they're intact.
+ */
+int SigPool_Verify(int fdIdx, const IndexHeader* pHdr);
+
+#endif
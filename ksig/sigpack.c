@@ -0,0 +1,663 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * sigpack.c
+ * by Keith Gaughan
+ *
+ * Compressed signature files, any one signature of which can be read without
+ * unpacking the rest.
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sigindex.h"
+#include "sigpack.h"
+
+/*
+ * Pack Format
+ * ===========
+ *
+ * The signatures are laid end to end, without the `%' lines between them,
+ * and cut into blocks of about BLOCK_SIZE bytes, each compressed on its own.
+ * A signature never straddles two blocks, so printing one means reading
+ * and unpacking a single block. A signature bigger than BLOCK_SIZE gets a
+ * block to itself. Like the index, everything's little-endian.
+ *
+ *   Offset  Size  Field
+ *   ------  ----  -----
+ *        0     4  Magic, `KSIZ'.
+ *        4     1  Version, PACK_VERSION.
+ *        5     3  Reserved, zero.
+ *        8     4  Number of entries.
+ *       12     4  Checksum of the header, with this field zeroed.
+ *       16     4  Checksum of the directory and table.
+ *       20     4  Number of blocks.
+ *       24     4  Size of the largest block, unpacked.
+ *       28     4  Reserved, zero.
+ *       32     8  Size of all the signatures, unpacked.
+ *       40     8  Size of the packed file.
+ *       48    16  Reserved, zero.
+ *
+ * The directory follows, one 16-byte entry per block: its offset in the
+ * file (8 bytes), its packed size and its unpacked size (4 bytes each).
+ * Then the table, one 12-byte entry per signature: its block, and its
+ * offset and length within the unpacked block. Then the blocks.
+ *
+ * Blocks are compressed with the LZ77 scheme used by LZ4's block format,
+ * so there's no library to depend on and unpacking is little more than
+ * memcpy(). Each block's a run of sequences, each a token byte, literals,
+ * then a match: the top four bits of the token are the number of literals,
+ * the bottom four the length of the match less MIN_MATCH, either being
+ * continued in further bytes if it's 15. The match is two bytes of how far
+ * back to copy from, then its length. The last sequence is literals only.
+ */
+
+#define PACK_MAGIC      "KSIZ"
+#define PACK_VERSION    1
+#define HEADER_SIZE     64
+#define DIR_SIZE        16
+#define ENTRY_SIZE      12
+#define BLOCK_SIZE      65536
+#define MAX_BLOCK       0x40000000UL
+#define TEMP_SUFFIX     ".XXXXXX"
+
+#define MIN_MATCH       4
+#define MAX_DISTANCE    65535
+#define HASH_BITS       12
+
+/*************** Encoding **/
+
+static uint32_t Checksum(uint32_t h, const unsigned char* p, size_t n)
+{
+    while (n-- > 0)
+    {
+        h ^= *p++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+static void Put(unsigned char* p, uint64_t n, int nBytes)
+{
+    while (nBytes-- > 0)
+    {
+        *p++ = (unsigned char) (n & 0xFF);
+        n  >>= 8;
+    }
+}
+
+static uint64_t Get(const unsigned char* p, int nBytes)
+{
+    uint64_t n;
+
+    n = 0;
+    while (nBytes-- > 0)
+        n = (n << 8) | p[nBytes];
+    return n;
+}
+
+static void EncodeHeader(const PackHeader* pHdr, unsigned char* buf)
+{
+    memset(buf, 0, HEADER_SIZE);
+    memcpy(buf, PACK_MAGIC, 4);
+    buf[4] = PACK_VERSION;
+    Put(buf +  8, pHdr->nEntries,   4);
+    Put(buf + 16, pHdr->tableSum,   4);
+    Put(buf + 20, pHdr->nBlocks,    4);
+    Put(buf + 24, pHdr->maxBlock,   4);
+    Put(buf + 32, pHdr->rawSize,    8);
+    Put(buf + 40, pHdr->packedSize, 8);
+    Put(buf + 12, Checksum(2166136261UL, buf, HEADER_SIZE), 4);
+}
+
+static int DecodeHeader(unsigned char* buf, PackHeader* pHdr)
+{
+    uint32_t sum;
+
+    if (memcmp(buf, PACK_MAGIC, 4) != 0 || buf[4] != PACK_VERSION)
+        return 0;
+    sum = (uint32_t) Get(buf + 12, 4);
+    Put(buf + 12, 0, 4);
+    if (Checksum(2166136261UL, buf, HEADER_SIZE) != sum)
+        return 0;
+
+    pHdr->nEntries   = (uint32_t) Get(buf +  8, 4);
+    pHdr->tableSum   = (uint32_t) Get(buf + 16, 4);
+    pHdr->nBlocks    = (uint32_t) Get(buf + 20, 4);
+    pHdr->maxBlock   = (uint32_t) Get(buf + 24, 4);
+    pHdr->rawSize    = Get(buf + 32, 8);
+    pHdr->packedSize = Get(buf + 40, 8);
+    return pHdr->maxBlock <= MAX_BLOCK;
+}
+
+/*************** Compression **/
+
+static uint32_t Read32(const unsigned char* p)
+{
+    uint32_t n;
+
+    memcpy(&n, p, sizeof n);
+    return n;
+}
+
+/*
+ * Lengths of 15 or more spill over into following bytes, each adding up to
+ * 255, with the first byte less than 255 ending it.
+ */
+static size_t PutLength(unsigned char* dst, size_t iDst, size_t n)
+{
+    if (n >= 15)
+    {
+        for (n -= 15; n >= 255; n -= 255)
+            dst[iDst++] = 255;
+        dst[iDst++] = (unsigned char) n;
+    }
+    return iDst;
+}
+
+static int GetLength(const unsigned char* src, size_t cbSrc, size_t* piSrc, size_t* pn)
+{
+    unsigned char b;
+
+    if (*pn == 15)
+    {
+        do
+        {
+            if (*piSrc >= cbSrc)
+                return 0;
+            b    = src[(*piSrc)++];
+            *pn += b;
+        } while (b == 255);
+    }
+    return 1;
+}
+
+/*
+ * Writes a sequence of `nLit' literals followed by a match `length' bytes
+ * long, `distance' back. A length of zero means there's no match, as at the
+ * end of a block.
+ */
+static size_t PutSequence(unsigned char* dst, size_t iDst, const unsigned char* lit,
+                          size_t nLit, size_t distance, size_t length)
+{
+    size_t iToken;
+
+    iToken      = iDst++;
+    dst[iToken] = (unsigned char) ((nLit < 15 ? nLit : 15) << 4);
+    iDst        = PutLength(dst, iDst, nLit);
+    memcpy(dst + iDst, lit, nLit);
+    iDst += nLit;
+
+    if (length > 0)
+    {
+        dst[iDst++]  = (unsigned char) (distance & 0xFF);
+        dst[iDst++]  = (unsigned char) (distance >> 8);
+        length      -= MIN_MATCH;
+        dst[iToken] |= (unsigned char) (length < 15 ? length : 15);
+        iDst         = PutLength(dst, iDst, length);
+    }
+    return iDst;
+}
+
+/*
+ * The most `n' bytes can grow to: incompressible data comes out as one long
+ * run of literals.
+ */
+static size_t PackBound(size_t n)
+{
+    return n + n / 255 + 16;
+}
+
+/*
+ * Greedy matching against the last place each four-byte string was seen.
+ * It's nowhere near the best compression there is, but signatures are
+ * plain text and repetitive enough that it does well, and it's quick.
+ */
+static size_t Compress(const unsigned char* src, size_t n, unsigned char* dst)
+{
+    size_t   table[1 << HASH_BITS];
+    size_t   iSrc;
+    size_t   iDst;
+    size_t   anchor;
+    size_t   match;
+    size_t   length;
+    uint32_t v;
+    uint32_t h;
+
+    memset(table, 0, sizeof table);
+    iSrc = iDst = anchor = 0;
+    while (n >= MIN_MATCH && iSrc <= n - MIN_MATCH)
+    {
+        v        = Read32(src + iSrc);
+        h        = (uint32_t) (v * 2654435761UL) >> (32 - HASH_BITS);
+        match    = table[h];
+        table[h] = iSrc + 1;
+        if (match == 0 || iSrc - --match > MAX_DISTANCE || Read32(src + match) != v)
+        {
+            iSrc++;
+            continue;
+        }
+
+        length = MIN_MATCH;
+        while (iSrc + length < n && src[match + length] == src[iSrc + length])
+            length++;
+        iDst   = PutSequence(dst, iDst, src + anchor, iSrc - anchor, iSrc - match, length);
+        iSrc  += length;
+        anchor = iSrc;
+    }
+    return PutSequence(dst, iDst, src + anchor, n - anchor, 0, 0);
+}
+
+/*
+ * Unpacks exactly `cbDst' bytes. Everything read from the block's checked,
+ * so a damaged block fails rather than writing outside `dst'.
+ */
+static int Expand(const unsigned char* src, size_t cbSrc, unsigned char* dst, size_t cbDst)
+{
+    size_t iSrc;
+    size_t iDst;
+    size_t n;
+    size_t distance;
+    int    token;
+
+    iSrc = iDst = 0;
+    while (iSrc < cbSrc)
+    {
+        token = src[iSrc++];
+        n     = (size_t) (token >> 4);
+        if (!GetLength(src, cbSrc, &iSrc, &n) || n > cbSrc - iSrc || n > cbDst - iDst)
+            return 0;
+        memcpy(dst + iDst, src + iSrc, n);
+        iSrc += n;
+        iDst += n;
+        if (iSrc == cbSrc)
+            break;
+
+        if (cbSrc - iSrc < 2)
+            return 0;
+        distance = (size_t) src[iSrc] | (size_t) src[iSrc + 1] << 8;
+        iSrc    += 2;
+        n        = (size_t) (token & 15);
+        if (!GetLength(src, cbSrc, &iSrc, &n))
+            return 0;
+        n += MIN_MATCH;
+        if (distance == 0 || distance > iDst || n > cbDst - iDst)
+            return 0;
+
+        /* Overlapping matches repeat what's just been written. */
+        if (distance >= n)
+        {
+            memcpy(dst + iDst, dst + iDst - distance, n);
+            iDst += n;
+        }
+        else
+        {
+            for (; n > 0; n--, iDst++)
+                dst[iDst] = dst[iDst - distance];
+        }
+    }
+    return iDst == cbDst;
+}
+
+/*************** Packing **/
+
+/*
+ * Packs the signatures in `entries' into blocks, written out after the
+ * header, directory and table, which are filled in here and written last.
+ */
+static int WriteBlocks(FILE* f, const unsigned char* data, const IndexEntry* entries,
+                       PackHeader* pHdr, unsigned char* dir, unsigned char* table)
+{
+    unsigned char* raw;
+    unsigned char* packed;
+    size_t         cbRaw;
+    size_t         cbPacked;
+    uint64_t       offset;
+    uint32_t       iEntry;
+    uint32_t       iBlock;
+    int            ok;
+
+    raw    = malloc(pHdr->maxBlock > 0 ? pHdr->maxBlock : 1);
+    packed = malloc(PackBound(pHdr->maxBlock));
+    ok     = raw != NULL && packed != NULL;
+
+    offset = HEADER_SIZE + (uint64_t) pHdr->nBlocks * DIR_SIZE + (uint64_t) pHdr->nEntries * ENTRY_SIZE;
+    iEntry = 0;
+    for (iBlock = 0; ok && iBlock < pHdr->nBlocks; iBlock++)
+    {
+        /* The block numbers in the table say where each block ends. */
+        cbRaw = 0;
+        while (iEntry < pHdr->nEntries && Get(table + (size_t) iEntry * ENTRY_SIZE, 4) == iBlock)
+        {
+            memcpy(raw + cbRaw, data + entries[iEntry].offset, (size_t) entries[iEntry].length);
+            cbRaw += (size_t) entries[iEntry].length;
+            iEntry++;
+        }
+
+        cbPacked = Compress(raw, cbRaw, packed);
+        ok       = fwrite(packed, 1, cbPacked, f) == cbPacked;
+        Put(dir + (size_t) iBlock * DIR_SIZE,      offset,   8);
+        Put(dir + (size_t) iBlock * DIR_SIZE + 8,  cbPacked, 4);
+        Put(dir + (size_t) iBlock * DIR_SIZE + 12, cbRaw,    4);
+        offset += cbPacked;
+    }
+    pHdr->packedSize = offset;
+
+    free(raw);
+    free(packed);
+    return ok;
+}
+
+/*
+ * Works out which block each signature goes in, filling in the table, and
+ * how many blocks there are and how big the biggest is.
+ */
+static void Layout(const IndexEntry* entries, PackHeader* pHdr, unsigned char* table)
+{
+    uint64_t cbBlock;
+    uint32_t iEntry;
+
+    pHdr->nBlocks  = 0;
+    pHdr->maxBlock = 0;
+    pHdr->rawSize  = 0;
+    cbBlock        = 0;
+    for (iEntry = 0; iEntry < pHdr->nEntries; iEntry++)
+    {
+        if (pHdr->nBlocks == 0 || (cbBlock > 0 && cbBlock + entries[iEntry].length > BLOCK_SIZE))
+        {
+            pHdr->nBlocks++;
+            cbBlock = 0;
+        }
+        Put(table + (size_t) iEntry * ENTRY_SIZE,     pHdr->nBlocks - 1,      4);
+        Put(table + (size_t) iEntry * ENTRY_SIZE + 4, cbBlock,                4);
+        Put(table + (size_t) iEntry * ENTRY_SIZE + 8, entries[iEntry].length, 4);
+        cbBlock       += entries[iEntry].length;
+        pHdr->rawSize += entries[iEntry].length;
+        if (cbBlock > pHdr->maxBlock)
+            pHdr->maxBlock = (uint32_t) cbBlock;
+    }
+}
+
+/*
+ * Reads the index's table, as long as the index is up to date with the
+ * signature file.
+ */
+static IndexEntry* ReadEntries(const char* idxPath, const struct stat* sbSigs, uint32_t* pnEntries)
+{
+    IndexHeader hdr;
+    IndexEntry* entries;
+    FILE*       fIdx;
+
+    fIdx = fopen(idxPath, "rb");
+    if (fIdx == NULL)
+        return NULL;
+    entries = NULL;
+    if (SigIndex_ReadHeader(fileno(fIdx), &hdr) && SigIndex_IsCurrent(&hdr, sbSigs))
+    {
+        entries = malloc(hdr.nEntries > 0 ? hdr.nEntries * sizeof(IndexEntry) : 1);
+        if (entries != NULL && !SigIndex_ReadTable(fIdx, &hdr, entries))
+        {
+            free(entries);
+            entries = NULL;
+        }
+        *pnEntries = hdr.nEntries;
+    }
+    fclose(fIdx);
+    return entries;
+}
+
+int SigPack_Build(const char* sigsPath, const char* idxPath, const char* packPath,
+                  PackHeader* pHdr)
+{
+    unsigned char  hdr[HEADER_SIZE];
+    struct stat    sb;
+    IndexEntry*    entries;
+    unsigned char* dir;
+    unsigned char* table;
+    void*          data;
+    char*          tmpPath;
+    FILE*          f;
+    int            fd;
+    int            ok;
+
+    fd = open(sigsPath, O_RDONLY);
+    if (fd == -1)
+        return 0;
+    if (fstat(fd, &sb) == -1 || (uint64_t) sb.st_size != (uint64_t) (size_t) sb.st_size ||
+        (entries = ReadEntries(idxPath, &sb, &pHdr->nEntries)) == NULL)
+    {
+        close(fd);
+        return 0;
+    }
+
+    data = NULL;
+    if (sb.st_size > 0)
+    {
+        data = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+            data = NULL;
+        else
+            posix_madvise(data, (size_t) sb.st_size, POSIX_MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    table = malloc(pHdr->nEntries > 0 ? (size_t) pHdr->nEntries * ENTRY_SIZE : 1);
+    dir   = NULL;
+    ok    = table != NULL && (data != NULL || sb.st_size == 0);
+    if (ok)
+    {
+        Layout(entries, pHdr, table);
+        dir = malloc(pHdr->nBlocks > 0 ? (size_t) pHdr->nBlocks * DIR_SIZE : 1);
+        ok  = dir != NULL;
+    }
+
+    /* As with an index, the packed file's written alongside and renamed. */
+    f = NULL;
+    if (ok)
+    {
+        tmpPath = malloc(strlen(packPath) + sizeof TEMP_SUFFIX);
+        if (tmpPath != NULL)
+        {
+            strcat(strcpy(tmpPath, packPath), TEMP_SUFFIX);
+            fd = mkstemp(tmpPath);
+            f  = fd == -1 ? NULL : fdopen(fd, "wb");
+            if (f == NULL)
+            {
+                if (fd != -1)
+                {
+                    close(fd);
+                    unlink(tmpPath);
+                }
+                free(tmpPath);
+            }
+        }
+    }
+
+    if (f != NULL)
+    {
+        /* Leave room for the header and directory until the blocks are in. */
+        memset(hdr, 0, sizeof hdr);
+        ok = fwrite(hdr, 1, HEADER_SIZE, f) == HEADER_SIZE &&
+             fseek(f, (long) (HEADER_SIZE + (uint64_t) pHdr->nBlocks * DIR_SIZE), SEEK_SET) == 0 &&
+             fwrite(table, ENTRY_SIZE, pHdr->nEntries, f) == pHdr->nEntries &&
+             WriteBlocks(f, (const unsigned char*) data, entries, pHdr, dir, table);
+        if (ok)
+        {
+            pHdr->tableSum = Checksum(2166136261UL, dir, (size_t) pHdr->nBlocks * DIR_SIZE);
+            pHdr->tableSum = Checksum(pHdr->tableSum, table, (size_t) pHdr->nEntries * ENTRY_SIZE);
+            EncodeHeader(pHdr, hdr);
+            ok = fseek(f, 0, SEEK_SET) == 0 &&
+                 fwrite(hdr, 1, HEADER_SIZE, f) == HEADER_SIZE &&
+                 fwrite(dir, DIR_SIZE, pHdr->nBlocks, f) == pHdr->nBlocks;
+        }
+        if (ferror(f))
+            ok = 0;
+        if (fclose(f) != 0)
+            ok = 0;
+        if (ok)
+            ok = rename(tmpPath, packPath) == 0;
+        if (!ok)
+            unlink(tmpPath);
+        free(tmpPath);
+    }
+    else
+    {
+        ok = 0;
+    }
+
+    if (data != NULL)
+        munmap(data, (size_t) sb.st_size);
+    free(entries);
+    free(table);
+    free(dir);
+    return ok;
+}
+
+/*************** Unpacking **/
+
+int SigPack_Open(const char* packPath, PackHeader* pHdr)
+{
+    unsigned char buf[HEADER_SIZE];
+    int           fd;
+
+    fd = open(packPath, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (pread(fd, buf, HEADER_SIZE, 0) != HEADER_SIZE || !DecodeHeader(buf, pHdr))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Reads and unpacks a block, returning it in a freshly allocated buffer.
+ */
+static unsigned char* ReadBlock(int fdPack, const PackHeader* pHdr, uint32_t iBlock, size_t* pcbRaw)
+{
+    unsigned char  buf[DIR_SIZE];
+    unsigned char* packed;
+    unsigned char* raw;
+    uint64_t       offset;
+    size_t         cbPacked;
+    int            ok;
+
+    if (iBlock >= pHdr->nBlocks ||
+        pread(fdPack, buf, DIR_SIZE, (off_t) (HEADER_SIZE + (uint64_t) iBlock * DIR_SIZE)) != DIR_SIZE)
+        return NULL;
+    offset   = Get(buf, 8);
+    cbPacked = (size_t) Get(buf + 8, 4);
+    *pcbRaw  = (size_t) Get(buf + 12, 4);
+    if (*pcbRaw > pHdr->maxBlock || cbPacked > PackBound(*pcbRaw))
+        return NULL;
+
+    packed = malloc(cbPacked > 0 ? cbPacked : 1);
+    raw    = malloc(*pcbRaw > 0 ? *pcbRaw : 1);
+    ok     = packed != NULL && raw != NULL &&
+             pread(fdPack, packed, cbPacked, (off_t) offset) == (ssize_t) cbPacked &&
+             Expand(packed, cbPacked, raw, *pcbRaw);
+    free(packed);
+    if (!ok)
+    {
+        free(raw);
+        raw = NULL;
+    }
+    return raw;
+}
+
+static int ReadPackEntry(int fdPack, const PackHeader* pHdr, uint32_t iEntry,
+                         uint32_t* piBlock, size_t* pOffset, size_t* pLength)
+{
+    unsigned char buf[ENTRY_SIZE];
+    off_t         at;
+
+    if (iEntry >= pHdr->nEntries)
+        return 0;
+    at = (off_t) (HEADER_SIZE + (uint64_t) pHdr->nBlocks * DIR_SIZE + (uint64_t) iEntry * ENTRY_SIZE);
+    if (pread(fdPack, buf, ENTRY_SIZE, at) != ENTRY_SIZE)
+        return 0;
+    *piBlock = (uint32_t) Get(buf, 4);
+    *pOffset = (size_t) Get(buf + 4, 4);
+    *pLength = (size_t) Get(buf + 8, 4);
+    return 1;
+}
+
+int SigPack_Fetch(int fdPack, const PackHeader* pHdr, uint32_t iEntry,
+                  char** pBlock, const char** pSig, size_t* pcbSig)
+{
+    unsigned char* raw;
+    uint32_t       iBlock;
+    size_t         cbRaw;
+    size_t         offset;
+
+    if (!ReadPackEntry(fdPack, pHdr, iEntry, &iBlock, &offset, pcbSig) ||
+        (raw = ReadBlock(fdPack, pHdr, iBlock, &cbRaw)) == NULL)
+        return 0;
+    if (*pcbSig > cbRaw || offset > cbRaw - *pcbSig)
+    {
+        free(raw);
+        return 0;
+    }
+    *pBlock = (char*) raw;
+    *pSig   = (const char*) raw + offset;
+    return 1;
+}
+
+int SigPack_Verify(int fdPack, const PackHeader* pHdr)
+{
+    unsigned char  buf[BUFSIZ];
+    unsigned char* raw;
+    uint64_t       cbTable;
+    uint64_t       offset;
+    uint32_t       sum;
+    uint32_t       iEntry;
+    uint32_t       iBlock;
+    uint32_t       iEntryBlock;
+    size_t         cbRaw;
+    size_t         at;
+    size_t         length;
+    size_t         n;
+
+    sum     = 2166136261UL;
+    cbTable = (uint64_t) pHdr->nBlocks * DIR_SIZE + (uint64_t) pHdr->nEntries * ENTRY_SIZE;
+    for (offset = 0; offset < cbTable; offset += n)
+    {
+        n = cbTable - offset < sizeof buf ? (size_t) (cbTable - offset) : sizeof buf;
+        if (pread(fdPack, buf, n, (off_t) (HEADER_SIZE + offset)) != (ssize_t) n)
+            return 0;
+        sum = Checksum(sum, buf, n);
+    }
+    if (sum != pHdr->tableSum)
+        return 0;
+
+    /* The table's in block order, so each block only needs unpacking once. */
+    iEntry = 0;
+    for (iBlock = 0; iBlock < pHdr->nBlocks; iBlock++)
+    {
+        raw = ReadBlock(fdPack, pHdr, iBlock, &cbRaw);
+        if (raw == NULL)
+            return 0;
+        free(raw);
+        for (; iEntry < pHdr->nEntries; iEntry++)
+        {
+            if (!ReadPackEntry(fdPack, pHdr, iEntry, &iEntryBlock, &at, &length) ||
+                iEntryBlock != iBlock)
+                break;
+            if (length > cbRaw || at > cbRaw - length)
+                return 0;
+        }
+    }
+    return iEntry == pHdr->nEntries;
+}
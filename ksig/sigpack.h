@@ -0,0 +1,84 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * sigpack.h
+ * by Keith Gaughan
+ *
+ * Compressed signature files, any one signature of which can be read without
+ * unpacking the rest.
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#ifndef SIGPACK_H
+#define SIGPACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A packed signature file is named after the plain one, with this on the
+ * end. It's only used if the plain one's gone. */
+#define PACK_SUFFIX ".z"
+
+typedef struct
+{
+    uint32_t nEntries;      /* Number of signatures.                    */
+    uint32_t nBlocks;       /* Number of blocks they're packed into.    */
+    uint32_t maxBlock;      /* Size of the largest block, unpacked.     */
+    uint32_t tableSum;      /* Checksum of the directory and table.     */
+    uint64_t rawSize;       /* Size of all the signatures, unpacked.    */
+    uint64_t packedSize;    /* Size of the packed file.                 */
+} PackHeader;
+
+/**
+ * Packs a signature file.
+ *
+ * @param  sigsPath  The signature file.
+ * @param  idxPath   Its index, which must be up to date.
+ * @param  packPath  Where to write the packed file.
+ * @param  pHdr      Filled in with the header of the packed file.
+ *
+ * @return Non-zero on success.
+ *
+ * @note   Only the signatures are kept, not the `%' lines between them, so
+ *         the plain file can't be had back byte for byte.
+ */
+int SigPack_Build(const char* sigsPath, const char* idxPath, const char* packPath,
+                  PackHeader* pHdr);
+
+/**
+ * Opens a packed signature file and checks its header's intact.
+ *
+ * @param  packPath  The packed file.
+ * @param  pHdr      Filled in with its header.
+ *
+ * @return Its descriptor, or -1 on failure.
+ */
+int SigPack_Open(const char* packPath, PackHeader* pHdr);
+
+/**
+ * Unpacks a single signature.
+ *
+ * @param  fdPack  Descriptor of the packed file.
+ * @param  pHdr    Its header.
+ * @param  iEntry  Which signature; must be less than pHdr->nEntries.
+ * @param  pBlock  Filled in with the unpacked block the signature's in, to
+ *                 be freed by the caller.
+ * @param  pSig    Filled in with where the signature starts in the block.
+ * @param  pcbSig  Filled in with its length.
+ *
+ * @return Non-zero on success.
+ */
+int SigPack_Fetch(int fdPack, const PackHeader* pHdr, uint32_t iEntry,
+                  char** pBlock, const char** pSig, size_t* pcbSig);
+
+/**
+ * Checks the directory and table against their checksum, and that every
+ * block unpacks and every signature lies within its block.
+ *
+ * @return Non-zero if they're intact.
+ */
+int SigPack_Verify(int fdPack, const PackHeader* pHdr);
+
+#endif
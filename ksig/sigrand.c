@@ -0,0 +1,238 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * sigrand.c
+ * by Keith Gaughan
+ *
+ * Random numbers for picking signatures.
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+#include "sigrand.h"
+
+/*
+ * The generator's xoshiro256** (Blackman & Vigna), which is quick, passes
+ * everything thrown at it, and only needs seeding once. Seeding it from the
+ * clock, as srand(time(NULL)) did, meant every ksig started in the same
+ * second printed the same signature, so the seed comes from the operating
+ * system instead.
+ */
+
+#define CYCLE_MAGIC "KSEQ"
+#define CYCLE_SIZE  20
+
+static uint64_t state[4];
+
+static uint64_t Rotate(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/* splitmix64, for spreading a seed out over the state, and for mixing. */
+static uint64_t Mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static int ReadUrandom(void* buf, size_t n)
+{
+    ssize_t nRead;
+    int     fd;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd == -1)
+        return 0;
+    nRead = read(fd, buf, n);
+    close(fd);
+    return nRead == (ssize_t) n;
+}
+
+void SigRand_Seed(void)
+{
+    uint64_t seed;
+    int      iWord;
+    int      ok;
+
+#ifdef __linux__
+    ok = getrandom(state, sizeof state, 0) == (ssize_t) sizeof state;
+#else
+    ok = 0;
+#endif
+    if (!ok)
+        ok = ReadUrandom(state, sizeof state);
+
+    /* Failing all that, do the best we can. */
+    if (!ok)
+    {
+        seed = (uint64_t) time(NULL) ^ (uint64_t) getpid() << 32 ^ (uint64_t) clock();
+        for (iWord = 0; iWord < 4; iWord++)
+            state[iWord] = Mix(seed += 0x9E3779B97F4A7C15ULL);
+    }
+
+    /* All zeroes is the one state it can't get out of. */
+    if ((state[0] | state[1] | state[2] | state[3]) == 0)
+        state[0] = 1;
+}
+
+uint64_t SigRand_Next64(void)
+{
+    uint64_t result;
+    uint64_t t;
+
+    result = Rotate(state[1] * 5, 7) * 9;
+    t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = Rotate(state[3], 45);
+    return result;
+}
+
+uint32_t SigRand_Next(void)
+{
+    return (uint32_t) (SigRand_Next64() >> 32);
+}
+
+/*
+ * Taking the remainder favours the low numbers whenever `n' doesn't divide
+ * 2^32, which matters once there are millions of signatures. This is
+ * Lemire's method: multiply up into 64 bits and take the top half, and
+ * only in the rare case the bottom half lands in the biased sliver is a
+ * division needed to decide whether to go again.
+ */
+uint32_t SigRand_Below(uint32_t n)
+{
+    uint64_t m;
+    uint32_t threshold;
+
+    m = (uint64_t) SigRand_Next() * n;
+    if ((uint32_t) m < n)
+    {
+        threshold = -n % n;
+        while ((uint32_t) m < threshold)
+            m = (uint64_t) SigRand_Next() * n;
+    }
+    return (uint32_t) (m >> 32);
+}
+
+/*
+ * A Feistel network is a permutation of whatever it's given, whatever its
+ * round function, so four rounds over the smallest even number of bits that
+ * holds `n' make a permutation of up to four times as many numbers as we
+ * need. Anything that lands outside the range is put through again until
+ * it lands inside it, which keeps it a permutation of the numbers below `n'.
+ */
+uint32_t SigRand_Permute(uint64_t key, uint32_t n, uint32_t i)
+{
+    uint64_t x;
+    uint64_t mask;
+    uint64_t left;
+    uint64_t right;
+    uint64_t t;
+    int      half;
+    int      round;
+
+    if (n <= 1)
+        return 0;
+    for (half = 1; ((uint64_t) 1 << (half * 2)) < n; half++)
+        ;
+    mask = ((uint64_t) 1 << half) - 1;
+
+    x = i;
+    do
+    {
+        left  = x >> half;
+        right = x & mask;
+        for (round = 0; round < 4; round++)
+        {
+            t     = right;
+            right = left ^ (Mix(key + (uint64_t) round * 0x9E3779B97F4A7C15ULL + right) & mask);
+            left  = t;
+        }
+        x = (left << half) | right;
+    } while (x >= n);
+
+    return (uint32_t) x;
+}
+
+static void Put(unsigned char* p, uint64_t n, int nBytes)
+{
+    while (nBytes-- > 0)
+    {
+        *p++ = (unsigned char) n;
+        n >>= 8;
+    }
+}
+
+static uint64_t Get(const unsigned char* p, int nBytes)
+{
+    uint64_t n;
+
+    n = 0;
+    while (nBytes-- > 0)
+        n = n << 8 | p[nBytes];
+    return n;
+}
+
+/*
+ * The state file's twenty bytes, little-endian: the magic, `KSEQ', then `n',
+ * how far through the shuffle we are, and the key of the shuffle. It's
+ * locked while it's read and updated, so concurrent runs don't both take
+ * the same number.
+ */
+int SigRand_NextInCycle(const char* statePath, uint32_t n, uint32_t* pI)
+{
+    unsigned char buf[CYCLE_SIZE];
+    struct flock  fl;
+    uint64_t      key;
+    uint32_t      cursor;
+    int           fd;
+    int           ok;
+
+    fd = open(statePath, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+        return 0;
+    memset(&fl, 0, sizeof fl);
+    fl.l_type   = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    if (fcntl(fd, F_SETLKW, &fl) == -1)
+    {
+        close(fd);
+        return 0;
+    }
+
+    if (pread(fd, buf, sizeof buf, 0) == (ssize_t) sizeof buf &&
+        memcmp(buf, CYCLE_MAGIC, 4) == 0 && Get(buf + 4, 4) == n && Get(buf + 8, 4) < n)
+    {
+        cursor = (uint32_t) Get(buf + 8, 4);
+        key    = Get(buf + 12, 8);
+    }
+    else
+    {
+        cursor = 0;
+        key    = SigRand_Next64();
+    }
+
+    *pI = SigRand_Permute(key, n, cursor);
+
+    memcpy(buf, CYCLE_MAGIC, 4);
+    Put(buf + 4, n, 4);
+    Put(buf + 8, cursor + 1, 4);
+    Put(buf + 12, key, 8);
+    ok = pwrite(fd, buf, sizeof buf, 0) == (ssize_t) sizeof buf;
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,72 @@
+/*                                      vim:set ts=4 sw=4 noai sr sta et cin:
+ * sigrand.h
+ * by Keith Gaughan
+ *
+ * Random numbers for picking signatures.
+ *
+ * Copyright (c) Keith Gaughan, 2003
+ * This software is free; you can redistribute it and/or modify it under the
+ * terms of the Design Science License (DSL). If you didn't receive a copy of
+ * the DSL, one can be obtained at <http://www.dsl.org/copyleft/dsl.txt>.
+ */
+
+#ifndef SIGRAND_H
+#define SIGRAND_H
+
+#include <stdint.h>
+
+/* State for walking through signatures without repeats is kept next to the
+ * signature file, with this on the end of its name. */
+#define CYCLE_SUFFIX ".seq"
+
+/**
+ * Seeds the generator from the operating system. Call it once before
+ * anything else here.
+ */
+void SigRand_Seed(void);
+
+/**
+ * @return A random number over the full 32 bits.
+ */
+uint32_t SigRand_Next(void);
+
+/**
+ * @return A random number over the full 64 bits.
+ */
+uint64_t SigRand_Next64(void);
+
+/**
+ * @param  n  The upper bound, which mustn't be zero.
+ *
+ * @return A random number less than `n', with every one of them equally
+ *         likely.
+ */
+uint32_t SigRand_Below(uint32_t n);
+
+/**
+ * Shuffles the numbers below `n' without having to store the shuffle.
+ *
+ * @param  key  Which shuffle.
+ * @param  n    How many numbers are being shuffled.
+ * @param  i    Which of them to fetch; must be less than `n'.
+ *
+ * @return The i'th number in the shuffle. For a given key and `n', every
+ *         number below `n' comes up for exactly one `i'.
+ */
+uint32_t SigRand_Permute(uint64_t key, uint32_t n, uint32_t i);
+
+/**
+ * Fetches the next number in a shuffle of the numbers below `n' that's kept
+ * in a file, so that successive calls, even from different processes, go
+ * through every one of them before any comes up again. When the shuffle's
+ * exhausted or `n' changes, a new one's started.
+ *
+ * @param  statePath  Where the shuffle's kept.
+ * @param  n          How many numbers are being shuffled.
+ * @param  pI         Filled in with the next number.
+ *
+ * @return Non-zero on success.
+ */
+int SigRand_NextInCycle(const char* statePath, uint32_t n, uint32_t* pI);
+
+#endif
@@ -0,0 +1,413 @@
+/*
+ * batch.c
+ * by Keith Gaughan <http://talideon.com/>
+ *
+ * Runs a list of jobs, each after its own randomised delay, from a single
+ * process.
+ *
+ * Copyright (c) Keith Gaughan, 2013.
+ *
+ * "THE BEERWARE LICENSE" (Revision 42):
+ * Keith Gaughan wrote this program. As long as you retain this notice,
+ * you can do whatever you like with it. If we meet some day, and you
+ * think this program is worth it, you can buy me a beer in return.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "randomdelay.h"
+
+/*
+ * Pending jobs hang off a timing wheel with a slot for each second. A job
+ * that's due further off than one turn of the wheel waits in its slot for
+ * that many more turns. Each second, the jobs due in the current slot are
+ * moved to the back of the ready queue, which is started from the front as
+ * the cap on running jobs allows. That way, a pending job costs nothing but
+ * its entry, and there's nothing to search to find the next one due.
+ */
+#define WHEEL_SLOTS 256
+
+struct job {
+	struct job *next;
+	unsigned long turns;
+	unsigned long ready_at;
+	pid_t pid;
+	struct run run;
+	char command[];
+};
+
+struct batch {
+	struct job *wheel[WHEEL_SLOTS];
+	struct job *ready;
+	struct job **ready_tail;
+	struct job *running;
+	unsigned long n_pending;
+	int n_running;
+	int max_running;
+	int failed;
+	sigset_t old_mask;
+
+	const struct slots *slots;
+	struct timespec start;
+	int fd_log;
+
+	const struct gate *gate;
+	int calm;
+	unsigned long next_poll;
+	unsigned long interval;
+};
+
+static void
+on_child(int sig)
+{
+	(void) sig;
+}
+
+static int
+add_job(struct batch *b, int maximum, const char *command)
+{
+	struct job *job;
+	struct timespec deadline;
+	unsigned long delay;
+
+	job = malloc(sizeof(struct job) + strlen(command) + 1);
+	if (job == NULL)
+		return 0;
+	strcpy(job->command, command);
+	job->pid = -1;
+	job->run.command = job->command;
+
+	/* The wheel only goes to the second, so round to the nearest one. */
+	clock_gettime(CLOCK_REALTIME, &job->run.picked);
+	pick_deadline(maximum, command, &deadline);
+	job->run.due = deadline;
+	delay = 0;
+	if (deadline.tv_sec >= b->start.tv_sec) {
+		delay = (unsigned long) (deadline.tv_sec - b->start.tv_sec);
+		if (deadline.tv_nsec - b->start.tv_nsec >= 500000000L)
+			delay++;
+		else if (deadline.tv_nsec - b->start.tv_nsec < -500000000L && delay > 0)
+			delay--;
+	}
+	job->turns = delay / WHEEL_SLOTS;
+	job->next = b->wheel[delay % WHEEL_SLOTS];
+	b->wheel[delay % WHEEL_SLOTS] = job;
+	b->n_pending++;
+	return 1;
+}
+
+/*
+ * Jobs are pushed onto the front of their slot as they're read, so each
+ * slot's turned around once they're all in, to start jobs that fall due in
+ * the same second in the order they're listed.
+ */
+static void
+reverse_slots(struct batch *b)
+{
+	struct job *job;
+	struct job *next;
+	struct job *prev;
+	int i;
+
+	for (i = 0; i < WHEEL_SLOTS; i++) {
+		prev = NULL;
+		for (job = b->wheel[i]; job != NULL; job = next) {
+			next = job->next;
+			job->next = prev;
+			prev = job;
+		}
+		b->wheel[i] = prev;
+	}
+}
+
+static int
+load_jobs(struct batch *b, const char *path)
+{
+	FILE *fp;
+	char *line;
+	char *command;
+	char *end;
+	size_t cb_line;
+	ssize_t n;
+	unsigned long line_no;
+	long maximum;
+	int ok;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: %s: %s\n", prog_name, path, strerror(errno));
+		return 0;
+	}
+
+	line = NULL;
+	cb_line = 0;
+	line_no = 0;
+	ok = 1;
+	while (ok && (n = getline(&line, &cb_line, fp)) != -1) {
+		line_no++;
+		while (n > 0 && isspace((unsigned char) line[n - 1]))
+			line[--n] = '\0';
+		for (command = line; isspace((unsigned char) *command); command++)
+			;
+		if (*command == '\0' || *command == '#')
+			continue;
+
+		maximum = strtol(command, &end, 10);
+		if (end == command || !isspace((unsigned char) *end) ||
+				maximum < 0 || maximum > INT_MAX / 60) {
+			fprintf(stderr, "%s: %s:%lu: expected <max> <command>\n",
+					prog_name, path, line_no);
+			ok = 0;
+			continue;
+		}
+		for (command = end; isspace((unsigned char) *command); command++)
+			;
+		if (!add_job(b, (int) maximum, command)) {
+			fprintf(stderr, "%s: %s\n", prog_name, strerror(errno));
+			ok = 0;
+		}
+	}
+	if (ferror(fp)) {
+		fprintf(stderr, "%s: %s: %s\n", prog_name, path, strerror(errno));
+		ok = 0;
+	}
+	free(line);
+	fclose(fp);
+	reverse_slots(b);
+	return ok;
+}
+
+/*
+ * Moves whatever's due this tick onto the ready queue.
+ */
+static void
+expire(struct batch *b, unsigned long tick)
+{
+	struct job **pp;
+	struct job *job;
+
+	pp = &b->wheel[tick % WHEEL_SLOTS];
+	while ((job = *pp) != NULL) {
+		if (job->turns > 0) {
+			job->turns--;
+			pp = &job->next;
+			continue;
+		}
+		*pp = job->next;
+		job->next = NULL;
+		job->ready_at = tick;
+		*b->ready_tail = job;
+		b->ready_tail = &job->next;
+		b->n_pending--;
+	}
+}
+
+/*
+ * Whether the job at the front of the ready queue may start. The gate's
+ * only checked every so often, backing off while the system stays busy,
+ * so a long queue of held jobs doesn't mean a long run of checks.
+ */
+static int
+may_launch(struct batch *b, unsigned long elapsed)
+{
+	if (b->gate == NULL)
+		return 1;
+	if (elapsed - b->ready->ready_at >= b->gate->deadline)
+		return 1;
+	if (elapsed >= b->next_poll) {
+		b->calm = gate_calm(b->gate);
+		b->interval = b->calm ? 0 : gate_backoff(b->interval);
+		b->next_poll = elapsed + (b->calm ? 1 : b->interval);
+	}
+	return b->calm;
+}
+
+static void
+launch(struct batch *b)
+{
+	struct job *job;
+
+	job = b->ready;
+	b->ready = job->next;
+	if (b->ready == NULL)
+		b->ready_tail = &b->ready;
+
+	/*
+	 * The slot's waited for in the child, which keeps it for the command,
+	 * so a job stuck waiting still counts against the cap on running jobs.
+	 */
+	clock_gettime(CLOCK_REALTIME, &job->run.started);
+	job->pid = fork();
+	if (job->pid == 0) {
+		sigprocmask(SIG_SETMASK, &b->old_mask, NULL);
+		if (b->fd_log != -1)
+			close(b->fd_log);
+		if (b->slots->dir != NULL && slot_acquire(b->slots->dir, b->slots->n_slots) == -1) {
+			fprintf(stderr, "%s: %s: %s\n", prog_name, b->slots->dir, strerror(errno));
+			_exit(127);
+		}
+		execl("/bin/sh", "sh", "-c", job->command, (char *) NULL);
+		_exit(127);
+	}
+	if (job->pid == -1) {
+		fprintf(stderr, "%s: %s: %s\n", prog_name, job->command, strerror(errno));
+		b->failed = 1;
+		free(job);
+		return;
+	}
+	job->next = b->running;
+	b->running = job;
+	b->n_running++;
+}
+
+/*
+ * Collects any jobs that have finished, returning how many.
+ */
+static int
+reap(struct batch *b)
+{
+	struct job **pp;
+	struct job *job;
+	struct usage usage;
+	pid_t pid;
+	int status;
+	int n;
+
+	n = 0;
+	while ((pid = reap_child(-1, WNOHANG, &status, &usage)) > 0) {
+		for (pp = &b->running; (job = *pp) != NULL; pp = &job->next)
+			if (job->pid == pid)
+				break;
+		if (job == NULL)
+			continue;
+		*pp = job->next;
+		b->n_running--;
+		n++;
+		if (b->fd_log != -1)
+			report_run(b->fd_log, pid, &job->run, status, &usage);
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "%s: `%s' exited with %d\n",
+					prog_name, job->command, WEXITSTATUS(status));
+			b->failed = 1;
+		} else if (WIFSIGNALED(status)) {
+			fprintf(stderr, "%s: `%s' killed by signal %d\n",
+					prog_name, job->command, WTERMSIG(status));
+			b->failed = 1;
+		}
+		free(job);
+	}
+	return n;
+}
+
+static void
+free_jobs(struct job *job)
+{
+	struct job *next;
+
+	for (; job != NULL; job = next) {
+		next = job->next;
+		free(job);
+	}
+}
+
+static unsigned long
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long) ts.tv_sec;
+}
+
+int
+run_batch(const char *path, int max_running, const struct gate *gate,
+		const struct slots *slots, int fd_log)
+{
+	struct batch b;
+	struct sigaction sa;
+	struct timespec timeout;
+	sigset_t chld;
+	unsigned long start;
+	unsigned long tick;
+	unsigned long elapsed;
+	unsigned long wake;
+	int i;
+
+	memset(&b, 0, sizeof(b));
+	b.ready_tail = &b.ready;
+	b.max_running = max_running;
+	b.slots = slots;
+	b.fd_log = fd_log;
+	clock_gettime(CLOCK_REALTIME, &b.start);
+	b.gate = gate != NULL && gate_enabled(gate) ? gate : NULL;
+	if (!load_jobs(&b, path)) {
+		for (i = 0; i < WHEEL_SLOTS; i++)
+			free_jobs(b.wheel[i]);
+		return 0;
+	}
+
+	/*
+	 * SIGCHLD's kept blocked and waited for with sigtimedwait(), so one
+	 * arriving just before we'd wait can't be missed. It needs a handler
+	 * all the same, or it may be thrown away rather than left pending.
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_child;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, NULL);
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, &b.old_mask);
+
+	start = now();
+	tick = 0;
+	for (;;) {
+		elapsed = now() - start;
+		while (b.n_pending > 0 && tick <= elapsed)
+			expire(&b, tick++);
+
+		while (b.ready != NULL && (b.max_running == 0 || b.n_running < b.max_running) &&
+				may_launch(&b, elapsed))
+			launch(&b);
+		if (reap(&b) > 0)
+			continue;
+		if (b.n_pending == 0 && b.ready == NULL && b.running == NULL)
+			break;
+
+		/*
+		 * Sleep until the next tick's due, the gate's next checked, the
+		 * job held back longest hits its deadline, or a job finishes.
+		 */
+		wake = b.n_pending > 0 ? tick : ULONG_MAX;
+		if (b.ready != NULL && b.gate != NULL && !b.calm) {
+			if (b.next_poll < wake)
+				wake = b.next_poll;
+			if (b.ready->ready_at + b.gate->deadline < wake)
+				wake = b.ready->ready_at + b.gate->deadline;
+		}
+		if (wake == ULONG_MAX) {
+			sigwaitinfo(&chld, NULL);
+			continue;
+		}
+		elapsed = now() - start;
+		if (wake <= elapsed)
+			continue;
+		timeout.tv_sec = (time_t) (wake - elapsed);
+		timeout.tv_nsec = 0;
+		sigtimedwait(&chld, NULL, &timeout);
+	}
+
+	sigprocmask(SIG_SETMASK, &b.old_mask, NULL);
+	return !b.failed;
+}
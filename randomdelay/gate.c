@@ -0,0 +1,91 @@
+/*
+ * gate.c
+ * by Keith Gaughan <http://talideon.com/>
+ *
+ * Holds jobs back while the system's busy.
+ *
+ * Copyright (c) Keith Gaughan, 2013.
+ *
+ * "THE BEERWARE LICENSE" (Revision 42):
+ * Keith Gaughan wrote this program. As long as you retain this notice,
+ * you can do whatever you like with it. If we meet some day, and you
+ * think this program is worth it, you can buy me a beer in return.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "randomdelay.h"
+
+/*
+ * Reads the share of the last ten seconds in which some task was stalled
+ * waiting on a resource, from Linux's pressure stall information. Where
+ * there's no such thing, there's no pressure.
+ */
+static double
+pressure(const char *path)
+{
+	char buf[256];
+	ssize_t n;
+	double avg10;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = '\0';
+	if (sscanf(buf, "some avg10=%lf", &avg10) != 1)
+		return 0;
+	return avg10;
+}
+
+int
+gate_enabled(const struct gate *g)
+{
+	return g->max_load > 0 || g->max_cpu > 0 || g->max_io > 0;
+}
+
+int
+gate_calm(const struct gate *g)
+{
+	double load;
+
+	if (g->max_load > 0 && getloadavg(&load, 1) == 1 && load > g->max_load)
+		return 0;
+	if (g->max_cpu > 0 && pressure("/proc/pressure/cpu") > g->max_cpu)
+		return 0;
+	if (g->max_io > 0 && pressure("/proc/pressure/io") > g->max_io)
+		return 0;
+	return 1;
+}
+
+unsigned long
+gate_backoff(unsigned long interval)
+{
+	if (interval < GATE_MIN_POLL)
+		return GATE_MIN_POLL;
+	return interval * 2 < GATE_MAX_POLL ? interval * 2 : GATE_MAX_POLL;
+}
+
+void
+gate_wait(const struct gate *g)
+{
+	unsigned long waited;
+	unsigned long interval;
+	unsigned long nap;
+
+	waited = 0;
+	interval = GATE_MIN_POLL;
+	while (waited < g->deadline && !gate_calm(g)) {
+		nap = interval < g->deadline - waited ? interval : g->deadline - waited;
+		waited += nap - sleep(nap);
+		interval = gate_backoff(interval);
+	}
+}
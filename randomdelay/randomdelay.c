@@ -12,7 +12,12 @@
  * think this program is worth it, you can buy me a beer in return.
  */
 
+#include <sys/types.h>
+#include <sys/wait.h>
+
 #include <errno.h>
+#include <libgen.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,24 +25,266 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "randomdelay.h"
+
+char *prog_name;
+
+/* Whether to spread runs by hashing rather than at random. */
+static int spread;
+
+/*
+ * The hash of the host's name and the command, put through the finaliser
+ * from SplitMix64 so that similar names don't land close together.
+ */
+static uint64_t
+hash_run(const char *command)
+{
+	char host[256];
+	const unsigned char *p;
+	uint64_t h;
+
+	if (gethostname(host, sizeof(host)) == -1)
+		host[0] = '\0';
+	host[sizeof(host) - 1] = '\0';
+
+	h = 14695981039346656037ULL;
+	for (p = (const unsigned char *) host; *p != '\0'; p++)
+		h = (h ^ *p) * 1099511628211ULL;
+	h = (h ^ 0) * 1099511628211ULL;
+	for (p = (const unsigned char *) command; *p != '\0'; p++)
+		h = (h ^ *p) * 1099511628211ULL;
+
+	h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+	return h ^ (h >> 31);
+}
+
+/*
+ * Spread runs start at the same offset into the window every time. Windows
+ * are laid end to end from the epoch, so every host agrees on where they
+ * start whenever cron gets round to starting us, and the run's due at the
+ * next time that offset comes round. That's never in the past, but it can
+ * be up to a whole window away if we were started just after it.
+ */
+void
+pick_deadline(int maximum, const char *command, struct timespec *deadline)
+{
+	uint64_t window, offset, now, due;
+
+	clock_gettime(CLOCK_REALTIME, deadline);
+	if (maximum <= 0)
+		return;
+	if (!spread) {
+		deadline->tv_sec += 60 * (time_t) (rand() % maximum);
+		return;
+	}
+
+	window = (uint64_t) maximum * 60000;
+	offset = hash_run(command) % window;
+	now = (uint64_t) deadline->tv_sec * 1000 + deadline->tv_nsec / 1000000;
+	due = now - now % window + offset;
+	if (due < now)
+		due += window;
+	deadline->tv_sec = (time_t) (due / 1000);
+	deadline->tv_nsec = (long) (due % 1000) * 1000000L;
+}
+
+static void
+sleep_until(const struct timespec *deadline)
+{
+	while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, deadline, NULL) == EINTR)
+		;
+}
+
+/*
+ * The command as a single string, for hashing.
+ */
+static char *
+join_args(char **argv)
+{
+	char *joined;
+	size_t n;
+	int i;
+
+	n = 1;
+	for (i = 0; argv[i] != NULL; i++)
+		n += strlen(argv[i]) + 1;
+	joined = malloc(n);
+	if (joined == NULL)
+		return NULL;
+	joined[0] = '\0';
+	for (i = 0; argv[i] != NULL; i++) {
+		if (i > 0)
+			strcat(joined, " ");
+		strcat(joined, argv[i]);
+	}
+	return joined;
+}
+
+/*
+ * Runs the command as a child rather than in our place, so that how it
+ * went can be logged. Like system(), we ignore the signals the terminal
+ * sends, and leave it to the command to act on them, handing it back
+ * whatever we'd been given for them.
+ */
+static int
+supervise(int fd_log, struct run *run, char **argv)
+{
+	struct usage usage;
+	void (*old_int)(int), (*old_quit)(int);
+	pid_t pid;
+	int status;
+
+	old_int = signal(SIGINT, SIG_IGN);
+	old_quit = signal(SIGQUIT, SIG_IGN);
+	clock_gettime(CLOCK_REALTIME, &run->started);
+	pid = fork();
+	if (pid == 0) {
+		signal(SIGINT, old_int);
+		signal(SIGQUIT, old_quit);
+		close(fd_log);
+		execvp(argv[0], argv);
+		fprintf(stderr, "%s: %s\n", prog_name, strerror(errno));
+		_exit(127);
+	}
+	if (pid == -1 || reap_child(pid, 0, &status, &usage) != pid) {
+		fprintf(stderr, "%s: %s\n", prog_name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	report_run(fd_log, pid, run, status, &usage);
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+			"Usage: %s [-d] [<gate>] <max> <cmd..>\n"
+			"       %s [-d] [<gate>] [-j <max-running>] -f <job-file>\n"
+			"Execute a command after a random delay (in minutes).\n"
+			"With -f, run each job in the file after its own random delay.\n"
+			"With -d, don't pick the delay at random, but spread runs evenly over\n"
+			"the window by hashing the host's name and the command.\n"
+			"\n"
+			"Once the delay's up, wait while the system's busy:\n"
+			"  -l <load>     until the load average is at most <load>\n"
+			"  -c <percent>  until CPU pressure is at most <percent>\n"
+			"  -i <percent>  until I/O pressure is at most <percent>\n"
+			"  -w <minutes>  but no longer than this (default: 60)\n"
+			"\n"
+			"Then wait in line for a slot, held until the command exits:\n"
+			"  -s <dir>      in the pool of slots kept in <dir>\n"
+			"  -n <slots>    of which there are this many (default: 1)\n"
+			"\n"
+			"  -L <log>      append a record of each run to <log>\n",
+			prog_name, prog_name);
+}
+
 int main(int argc, char** argv) {
 	int maximum;
-	char* prog_name;
-
-	prog_name = (char*) (intptr_t) basename(strdup(argv[0]));
-	if (argc < 3) {
-		fprintf(stderr,
-				"Usage: %s <max> <cmd..>\n"
-				"Execute a command after a random delay (in minutes).\n",
-				prog_name);
+	int max_running;
+	char* job_file;
+	struct gate gate;
+	struct slots slots;
+	struct run run;
+	char *command;
+	char *log_path;
+	int fd_log;
+	int ch;
+
+	prog_name = basename(strdup(argv[0]));
+
+	job_file = NULL;
+	max_running = 0;
+	memset(&gate, 0, sizeof(gate));
+	gate.deadline = 60 * 60;
+	slots.dir = NULL;
+	slots.n_slots = 1;
+	log_path = NULL;
+	while ((ch = getopt(argc, argv, "+L:c:df:i:j:l:n:s:w:")) != -1) {
+		switch (ch) {
+		case 'L':
+			log_path = optarg;
+			break;
+		case 'c':
+			gate.max_cpu = atof(optarg);
+			break;
+		case 'd':
+			spread = 1;
+			break;
+		case 'f':
+			job_file = optarg;
+			break;
+		case 'i':
+			gate.max_io = atof(optarg);
+			break;
+		case 'j':
+			max_running = atoi(optarg);
+			break;
+		case 'l':
+			gate.max_load = atof(optarg);
+			break;
+		case 'n':
+			slots.n_slots = atoi(optarg);
+			break;
+		case 's':
+			slots.dir = optarg;
+			break;
+		case 'w':
+			gate.deadline = 60 * (unsigned long) atoi(optarg);
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	fd_log = -1;
+	if (log_path != NULL && (fd_log = report_open(log_path)) == -1) {
+		fprintf(stderr, "%s: %s: %s\n", prog_name, log_path, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	/* Mix in the PID, so runs started in the same second differ. */
+	srand(time(NULL) ^ getpid());
+	if (job_file != NULL) {
+		if (argc != 0 || max_running < 0 || slots.n_slots < 1) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		return run_batch(job_file, max_running, &gate, &slots, fd_log) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc < 2 || slots.n_slots < 1) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	maximum = atoi(argv[0]);
+	command = spread || fd_log != -1 ? join_args(argv + 1) : NULL;
+	run.command = command != NULL ? command : argv[1];
+	clock_gettime(CLOCK_REALTIME, &run.picked);
+	pick_deadline(maximum, run.command, &run.due);
+	sleep_until(&run.due);
+	if (gate_enabled(&gate))
+		gate_wait(&gate);
+
+	/* The slot's descriptor is left open for the command to inherit. */
+	if (slots.dir != NULL && slot_acquire(slots.dir, slots.n_slots) == -1) {
+		fprintf(stderr, "%s: %s: %s\n", prog_name, slots.dir, strerror(errno));
 		return EXIT_FAILURE;
 	}
 
-	srand(time(NULL));
-	maximum = atoi(argv[1]);
-	sleep(60 * (maximum > 0 ? rand() % maximum : 0));
+	if (fd_log != -1) {
+		ch = supervise(fd_log, &run, &(argv[1]));
+		free(command);
+		return ch;
+	}
+	free(command);
 
-	execvp(argv[2], &(argv[2]));
+	execvp(argv[1], &(argv[1]));
 
 	fprintf(stderr, "%s: %s\n", prog_name, strerror(errno));
 	return EXIT_FAILURE;
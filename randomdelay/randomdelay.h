@@ -0,0 +1,139 @@
+/*
+ * randomdelay.h
+ * by Keith Gaughan <http://talideon.com/>
+ *
+ * Bits shared between the parts of randomdelay.
+ *
+ * Copyright (c) Keith Gaughan, 2013.
+ *
+ * "THE BEERWARE LICENSE" (Revision 42):
+ * Keith Gaughan wrote this program. As long as you retain this notice,
+ * you can do whatever you like with it. If we meet some day, and you
+ * think this program is worth it, you can buy me a beer in return.
+ */
+
+#ifndef RANDOMDELAY_H
+#define RANDOMDELAY_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
+
+/* What we were run as, for error messages. */
+extern char *prog_name;
+
+/*
+ * Works out when a run of `command' that's to be delayed by up to `maximum'
+ * minutes is due, as a time on the real-time clock. It's random, to the
+ * minute, unless runs are being spread, when it's to the millisecond.
+ */
+void pick_deadline(int maximum, const char *command, struct timespec *deadline);
+
+/*
+ * How busy the system may be for a job to start. Any threshold that's
+ * zero isn't checked. Once a job's been held back for `deadline' seconds,
+ * it's started regardless.
+ */
+struct gate {
+	double max_load;		/* One-minute load average. */
+	double max_cpu;			/* Percentage of time stalled on CPU... */
+	double max_io;			/* ...and on I/O, over the last ten seconds. */
+	unsigned long deadline;
+};
+
+/* How long to wait between checks, doubling each time it's still busy. */
+#define GATE_MIN_POLL	2
+#define GATE_MAX_POLL	64
+
+/*
+ * Returns non-zero if any threshold's set.
+ */
+int gate_enabled(const struct gate *g);
+
+/*
+ * Returns non-zero if the system's under every threshold.
+ */
+int gate_calm(const struct gate *g);
+
+/*
+ * Returns how long to wait before the next check, given the last wait.
+ */
+unsigned long gate_backoff(unsigned long interval);
+
+/*
+ * Waits until the system's under every threshold, or for the deadline.
+ */
+void gate_wait(const struct gate *g);
+
+/*
+ * A host-wide limit on how many jobs run at once, shared by every
+ * randomdelay given the same pool directory.
+ */
+struct slots {
+	const char *dir;		/* NULL if there's no limit. */
+	int n_slots;
+};
+
+/*
+ * Takes one of `n_slots' slots in the pool at `dir', creating it if need
+ * be, and waiting in line for one if they're all taken. Returns a
+ * descriptor that holds the slot until it's closed, including by the
+ * command it's passed to on exec, or -1 on failure.
+ */
+int slot_acquire(const char *dir, int n_slots);
+
+/*
+ * When a job was meant to run and when it did, all by the real-time clock.
+ */
+struct run {
+	const char *command;
+	struct timespec picked;		/* When its delay was picked. */
+	struct timespec due;		/* When it was due to start. */
+	struct timespec started;	/* When it was actually started. */
+};
+
+/*
+ * What a job used, for the log.
+ */
+struct usage {
+	struct rusage ru;
+	struct timespec finished;
+	long long read_bytes;		/* -1 if they couldn't be had. */
+	long long write_bytes;
+};
+
+/*
+ * Waits for a child, as waitpid() does, collecting what it used on the
+ * way. Returns its PID, zero if `options' includes WNOHANG and no child's
+ * exited, or -1 on failure.
+ */
+pid_t reap_child(pid_t pid, int options, int *status, struct usage *usage);
+
+/*
+ * Opens the log for appending, returning its descriptor or -1.
+ */
+int report_open(const char *path);
+
+/*
+ * Appends a record of a job's run to the log.
+ */
+void report_run(int fd, pid_t pid, const struct run *run, int status,
+		const struct usage *usage);
+
+/*
+ * Runs each job in `path' after its own random delay, with no more than
+ * `max_running' of them running at once, or any number if it's zero. Jobs
+ * that are due are held back while the gate's shut, and each job waits for
+ * a slot, if there's a pool, once it's started. If `fd_log' isn't -1, a
+ * record of each job's run is appended to it.
+ *
+ * Each line of the file is the maximum delay in minutes followed by a
+ * command, which is run with /bin/sh -c. Blank lines and lines starting
+ * with `#' are skipped.
+ *
+ * Returns non-zero if every job ran and exited successfully.
+ */
+int run_batch(const char *path, int max_running, const struct gate *gate,
+		const struct slots *slots, int fd_log);
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * report.c
+ * by Keith Gaughan <http://talideon.com/>
+ *
+ * Keeps a log of how long jobs waited and what they used.
+ *
+ * Copyright (c) Keith Gaughan, 2013.
+ *
+ * "THE BEERWARE LICENSE" (Revision 42):
+ * Keith Gaughan wrote this program. As long as you retain this notice,
+ * you can do whatever you like with it. If we meet some day, and you
+ * think this program is worth it, you can buy me a beer in return.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "randomdelay.h"
+
+/*
+ * Reads how many bytes the process caused to be read from and written to
+ * storage. It has to be done while it's a zombie, before it's reaped, as
+ * that's the last point its entry in /proc is there, by which time it
+ * includes whatever its own children did that it waited for.
+ */
+static void
+read_io(pid_t pid, struct usage *usage)
+{
+	char path[64];
+	char buf[512];
+	char *p;
+	ssize_t n;
+	int fd;
+
+	usage->read_bytes = -1;
+	usage->write_bytes = -1;
+	snprintf(path, sizeof(path), "/proc/%ld/io", (long) pid);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return;
+	buf[n] = '\0';
+	if ((p = strstr(buf, "\nread_bytes: ")) != NULL)
+		usage->read_bytes = strtoll(p + 13, NULL, 10);
+	if ((p = strstr(buf, "\nwrite_bytes: ")) != NULL)
+		usage->write_bytes = strtoll(p + 14, NULL, 10);
+}
+
+pid_t
+reap_child(pid_t pid, int options, int *status, struct usage *usage)
+{
+	siginfo_t info;
+
+	/* Look before reaping, so it's still there to be looked at. */
+	memset(&info, 0, sizeof(info));
+	while (waitid(pid == -1 ? P_ALL : P_PID, (id_t) (pid == -1 ? 0 : pid), &info,
+				WEXITED | WNOWAIT | options) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+	if (info.si_pid == 0)
+		return 0;
+
+	read_io(info.si_pid, usage);
+	while ((pid = wait4(info.si_pid, status, 0, &usage->ru)) == -1) {
+		if (errno != EINTR)
+			return -1;
+	}
+	clock_gettime(CLOCK_REALTIME, &usage->finished);
+	return pid;
+}
+
+int
+report_open(const char *path)
+{
+	return open(path, O_WRONLY | O_APPEND | O_CREAT, 0666);
+}
+
+static long long
+ms_between(const struct timespec *from, const struct timespec *to)
+{
+	return (long long) (to->tv_sec - from->tv_sec) * 1000 +
+		(to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+static long long
+tv_ms(const struct timeval *tv)
+{
+	return (long long) tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+/*
+ * Copies `s' into `out' as the inside of a JSON string, which needs up to
+ * six bytes for each byte of `s'.
+ */
+static char *
+escape(char *out, const char *s)
+{
+	const unsigned char *p;
+
+	for (p = (const unsigned char *) s; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\\') {
+			*out++ = '\\';
+			*out++ = (char) *p;
+		} else if (*p < 0x20) {
+			out += sprintf(out, "\\u%04x", *p);
+		} else {
+			*out++ = (char) *p;
+		}
+	}
+	*out = '\0';
+	return out;
+}
+
+/*
+ * Each record's one line of JSON, appended with a single write(), so the
+ * records of jobs finishing at once don't get mixed up.
+ */
+void
+report_run(int fd, pid_t pid, const struct run *run, int status, const struct usage *usage)
+{
+	char *line;
+	char *p;
+
+	line = malloc(strlen(run->command) * 6 + 512);
+	if (line == NULL)
+		return;
+
+	p = line + sprintf(line, "{\"time\":%lld,\"pid\":%ld,\"command\":\"",
+			(long long) run->started.tv_sec, (long) pid);
+	p = escape(p, run->command);
+	p += sprintf(p, "\",\"delay_ms\":%lld,\"skew_ms\":%lld,\"wall_ms\":%lld,"
+			"\"user_ms\":%lld,\"sys_ms\":%lld,\"max_rss_kb\":%ld,"
+			"\"read_bytes\":%lld,\"write_bytes\":%lld,",
+			ms_between(&run->picked, &run->due),
+			ms_between(&run->due, &run->started),
+			ms_between(&run->started, &usage->finished),
+			tv_ms(&usage->ru.ru_utime), tv_ms(&usage->ru.ru_stime),
+			usage->ru.ru_maxrss, usage->read_bytes, usage->write_bytes);
+	if (WIFSIGNALED(status))
+		p += sprintf(p, "\"signal\":%d}\n", WTERMSIG(status));
+	else
+		p += sprintf(p, "\"exit\":%d}\n", WEXITSTATUS(status));
+
+	write(fd, line, (size_t) (p - line));
+	free(line);
+}
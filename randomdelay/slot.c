@@ -0,0 +1,222 @@
+/*
+ * slot.c
+ * by Keith Gaughan <http://talideon.com/>
+ *
+ * Limits how many jobs run at once across the whole host.
+ *
+ * Copyright (c) Keith Gaughan, 2013.
+ *
+ * "THE BEERWARE LICENSE" (Revision 42):
+ * Keith Gaughan wrote this program. As long as you retain this notice,
+ * you can do whatever you like with it. If we meet some day, and you
+ * think this program is worth it, you can buy me a beer in return.
+ */
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "randomdelay.h"
+
+/*
+ * A pool's a directory with a lock file for each slot. Holding a flock()
+ * on one is holding the slot, and as the lock belongs to the open file
+ * rather than the process, it's kept across execvp() and let go of when
+ * the command exits, however it exits. There's no daemon and nothing to
+ * clean up after a crash.
+ *
+ * Waiters queue up in the order they took a ticket from the counter in
+ * `ticket'. Each holds a lock on a file named after its ticket while it
+ * waits, and blocks on the lock of the one ahead of it, so the queue moves
+ * up one at a time without anybody polling. A waiter that dies lets go of
+ * its lock, and the one behind it clears its file away. Only the waiter at
+ * the front polls for a free slot.
+ */
+
+#define SLOT_MIN_POLL	50		/* Milliseconds. */
+#define SLOT_MAX_POLL	250
+
+static int
+lock_fd(int fd, int how)
+{
+	while (flock(fd, how) == -1) {
+		if (errno != EINTR)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Joins the back of the queue. The ticket's taken and the waiter's file
+ * created under the counter's lock, so the queue's never missing anybody
+ * with an earlier ticket. The file's locked before it's given its proper
+ * name, so nobody can mistake it for one left behind by a waiter that died.
+ */
+static int
+join_queue(const char *dir, unsigned long long *ticket)
+{
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	char buf[32];
+	ssize_t n;
+	int fd_counter;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/ticket", dir);
+	fd_counter = open(path, O_RDWR | O_CREAT, 0666);
+	if (fd_counter == -1)
+		return -1;
+	fd = -1;
+	if (lock_fd(fd_counter, LOCK_EX)) {
+		n = pread(fd_counter, buf, sizeof(buf) - 1, 0);
+		buf[n > 0 ? n : 0] = '\0';
+		*ticket = strtoull(buf, NULL, 10);
+		n = snprintf(buf, sizeof(buf), "%llu\n", *ticket + 1);
+		if (pwrite(fd_counter, buf, (size_t) n, 0) == n && ftruncate(fd_counter, n) == 0) {
+			snprintf(tmp, sizeof(tmp), "%s/wait.%llu.new", dir, *ticket);
+			snprintf(path, sizeof(path), "%s/wait.%llu", dir, *ticket);
+			fd = open(tmp, O_RDWR | O_CREAT | O_EXCL, 0666);
+		}
+		if (fd != -1 && (!lock_fd(fd, LOCK_EX) || rename(tmp, path) == -1)) {
+			unlink(tmp);
+			close(fd);
+			fd = -1;
+		}
+	}
+	close(fd_counter);
+	return fd;
+}
+
+static void
+leave_queue(const char *dir, unsigned long long ticket, int fd)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/wait.%llu", dir, ticket);
+	unlink(path);
+	close(fd);
+}
+
+/*
+ * Finds the waiter immediately ahead of `ticket', if there is one.
+ */
+static int
+find_ahead(const char *dir, unsigned long long ticket, unsigned long long *ahead)
+{
+	DIR *dp;
+	struct dirent *de;
+	unsigned long long other, best;
+	char *end;
+	int found;
+
+	dp = opendir(dir);
+	if (dp == NULL)
+		return 0;
+	found = 0;
+	best = 0;
+	while ((de = readdir(dp)) != NULL) {
+		if (strncmp(de->d_name, "wait.", 5) != 0)
+			continue;
+		other = strtoull(de->d_name + 5, &end, 10);
+		if (*end != '\0' || end == de->d_name + 5 || other >= ticket)
+			continue;
+		if (!found || other > best)
+			best = other;
+		found = 1;
+	}
+	closedir(dp);
+	*ahead = best;
+	return found;
+}
+
+/*
+ * Waits until everybody ahead of us has left the queue, one way or the
+ * other.
+ */
+static int
+wait_turn(const char *dir, unsigned long long ticket)
+{
+	char path[PATH_MAX];
+	unsigned long long ahead;
+	int fd;
+
+	while (find_ahead(dir, ticket, &ahead)) {
+		snprintf(path, sizeof(path), "%s/wait.%llu", dir, ahead);
+		fd = open(path, O_RDONLY);
+		if (fd == -1) {
+			if (errno == ENOENT)
+				continue;
+			return 0;
+		}
+		if (!lock_fd(fd, LOCK_EX)) {
+			close(fd);
+			return 0;
+		}
+		/* Gone, or died waiting. Either way, clear it away. */
+		unlink(path);
+		close(fd);
+	}
+	return 1;
+}
+
+static int
+try_slots(const char *dir, int n_slots)
+{
+	char path[PATH_MAX];
+	int fd;
+	int i;
+
+	for (i = 0; i < n_slots; i++) {
+		snprintf(path, sizeof(path), "%s/slot.%d", dir, i);
+		fd = open(path, O_RDONLY | O_CREAT, 0666);
+		if (fd == -1)
+			return -1;
+		if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+			return fd;
+		close(fd);
+	}
+	errno = EWOULDBLOCK;
+	return -1;
+}
+
+int
+slot_acquire(const char *dir, int n_slots)
+{
+	struct timespec nap;
+	unsigned long long ticket;
+	long interval;
+	int fd_wait;
+	int fd;
+	int err;
+
+	if (mkdir(dir, 0777) == -1 && errno != EEXIST)
+		return -1;
+	fd_wait = join_queue(dir, &ticket);
+	if (fd_wait == -1)
+		return -1;
+
+	fd = -1;
+	if (wait_turn(dir, ticket)) {
+		interval = SLOT_MIN_POLL;
+		while ((fd = try_slots(dir, n_slots)) == -1 && errno == EWOULDBLOCK) {
+			nap.tv_sec = interval / 1000;
+			nap.tv_nsec = (interval % 1000) * 1000000L;
+			nanosleep(&nap, NULL);
+			interval = interval * 2 < SLOT_MAX_POLL ? interval * 2 : SLOT_MAX_POLL;
+		}
+	}
+	err = errno;
+	leave_queue(dir, ticket, fd_wait);
+	errno = err;
+	return fd;
+}